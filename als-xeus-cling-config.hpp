@@ -9,13 +9,20 @@
 #ifndef ALS_XEUS_CLING_CONFIG_HPP
 #define ALS_XEUS_CLING_CONFIG_HPP
 
-// Include paths.
+// Include paths. They are the defaults; more can be given at runtime with -I.
 // Copy below the include path of your cling installation.
 #define ALS_CLING_INCLUDE_PATH "/opt/cling/include"
 // Copy below the include path of the clang version the was installed with cling.
 // Do not write the include path your normal clang version!
 #define ALS_CLANG_INCLUDE_PATH "/opt/cling/lib/clang/9.0.1/include"
 
+// Precompiled prelude.
+// Location of the precompiled header built by the prelude target of the Makefile.
+// It can be overriden at runtime with the ALS_XEUS_CLING_PRELUDE_PCH environment
+// variable or the --pch flag. If the file is missing or older than the installed
+// headers, the kernel falls back to textual includes.
+#define ALS_XEUS_CLING_PRELUDE_PCH "/usr/share/als-xeus-cling/prelude.pch"
+
 // Project version
 #define ALS_XEUS_CLING_VERSION_MAJOR 0
 #define ALS_XEUS_CLING_VERSION_MINOR 1
@@ -0,0 +1,124 @@
+// Micro-benchmark of the post-processing of completion results: the regular
+// expressions formerly used by complete_request_impl against format_completion and
+// split_line. It only depends on the standard library.
+//
+// Usage: completion-bench [number of candidates]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../xcompletion.hpp"
+#include "../xparser.hpp"
+
+namespace
+{
+    // What complete_request_impl used to do for every candidate.
+    std::string regex_format_completion(std::string r)
+    {
+        r = std::regex_replace(r, std::regex("\\[\\#.*\\#\\]"), "");
+        r = std::regex_replace(r, std::regex("(\\ |\\*)+(\\w+)(\\#\\>)"), "$1$3");
+        r = std::regex_replace(r, std::regex("\\ *(\\#\\>)"), "$1");
+        r = std::regex_replace(r, std::regex("\\<\\#([^#>]*)\\#\\>"), "$1");
+        return r;
+    }
+
+    // What xcpp::split_line used to do for every request.
+    std::vector<std::string> regex_split_line(const std::string& input, const std::string& delims,
+        std::size_t cursor_pos)
+    {
+        std::vector<std::string> result;
+        std::stringstream ss;
+        ss << "[";
+        for (auto c : delims)
+        {
+            ss << "\\" << c;
+        }
+        ss << "]";
+        std::regex re(ss.str());
+        std::copy(std::sregex_token_iterator(input.begin(), input.begin() + cursor_pos, re, -1),
+            std::sregex_token_iterator(), std::back_inserter(result));
+        return result;
+    }
+
+    // Candidates similar to those returned by cling after "std::".
+    std::vector<std::string> make_candidates(std::size_t count)
+    {
+        const std::vector<std::string> patterns = {
+            "[#void#]sort(<#RandomIt first#>, <#RandomIt last#>)",
+            "[#std::size_t#]strlen(<#const char *str#>)",
+            "[#int#]accumulate(<#InputIt first#>, <#InputIt last#>, <#T init#>)",
+            "vector",
+            "[#double#]pow(<#double base#>, <#double exponent#>)"};
+        std::vector<std::string> res;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            res.push_back(patterns[i % patterns.size()] + std::to_string(i));
+        }
+        return res;
+    }
+
+    template<class F>
+    double measure_ms(F&& function)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const std::size_t count = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 5000;
+    const std::vector<std::string> candidates = make_candidates(count);
+
+    std::size_t checksum = 0;
+    double regex_ms = measure_ms([&]()
+        {
+            for (const std::string& c : candidates)
+            {
+                checksum += regex_format_completion(c).size();
+            }
+        });
+    double scanner_ms = measure_ms([&]()
+        {
+            for (const std::string& c : candidates)
+            {
+                checksum += als::xeus_cling::format_completion(c).size();
+            }
+        });
+
+    const std::string code = "std::vector<double> v(10);\nfor (auto& x : v) x = std::";
+    const std::string delims = " \t\n`!@#$^&*()=+[{]}\\|;:\'\",<>?.";
+    const std::size_t requests = 1000;
+    double regex_split_ms = measure_ms([&]()
+        {
+            for (std::size_t i = 0; i < requests; ++i)
+            {
+                checksum += regex_split_line(code, delims, code.size()).size();
+            }
+        });
+    double split_ms = measure_ms([&]()
+        {
+            for (std::size_t i = 0; i < requests; ++i)
+            {
+                checksum += xcpp::split_line(code, delims, code.size()).size();
+            }
+        });
+
+    std::cout << "{\"candidates\": " << count
+        << ", \"format_regex_ms\": " << regex_ms
+        << ", \"format_scanner_ms\": " << scanner_ms
+        << ", \"format_speedup\": " << regex_ms / scanner_ms
+        << ", \"split_requests\": " << requests
+        << ", \"split_regex_ms\": " << regex_split_ms
+        << ", \"split_view_ms\": " << split_ms
+        << ", \"split_speedup\": " << regex_split_ms / split_ms
+        << ", \"checksum\": " << checksum << "}" << std::endl;
+    return 0;
+}
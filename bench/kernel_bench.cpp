@@ -0,0 +1,624 @@
+// Latency benchmark of the kernel through the Jupyter protocol: it starts the kernel
+// with a generated connection file, talks to it over local ZMQ sockets as a frontend
+// would, and replays scripted workloads. The results are written as one JSON object on
+// the standard output, so that they can be compared between builds; the kernel log
+// goes to the standard error.
+//
+// Usage: kernel-bench <kernel executable> [repetitions] [startups]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <zmq.h>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    // Maximum time a request may take before the benchmark gives up.
+    constexpr std::chrono::seconds request_timeout{120};
+
+    const std::string delimiter = "<IDS|MSG>";
+
+    double milliseconds_since(clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+
+    std::string random_hex(std::size_t length)
+    {
+        static std::random_device device;
+        static const char digits[] = "0123456789abcdef";
+        std::string res(length, '0');
+        for (char& c : res)
+        {
+            c = digits[device() % 16];
+        }
+        return res;
+    }
+
+    // Ports the kernel can bind: they are found by binding them here first.
+    std::vector<int> free_ports(std::size_t count)
+    {
+        std::vector<int> sockets;
+        std::vector<int> res;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = 0;
+            socklen_t length = sizeof(address);
+            if (fd == -1 || bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+                getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+            {
+                throw std::runtime_error("could not find a free port");
+            }
+            sockets.push_back(fd);
+            res.push_back(ntohs(address.sin_port));
+        }
+        for (int fd : sockets)
+        {
+            close(fd);
+        }
+        return res;
+    }
+
+    std::string utc_now()
+    {
+        const std::time_t now = std::time(nullptr);
+        char buffer[32];
+        std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        return buffer;
+    }
+
+    struct message
+    {
+        nl::json header;
+        nl::json parent_header;
+        nl::json content;
+        std::size_t bytes = 0;
+    };
+
+    // A frontend connected to the shell, iopub and control channels of the kernel.
+    class client
+    {
+        public:
+
+        client(const nl::json& connection):
+            m_key{connection["key"].get<std::string>()},
+            m_session{random_hex(32)},
+            m_context{zmq_ctx_new()}
+        {
+            const std::string address = "tcp://" + connection["ip"].get<std::string>() + ":";
+            m_shell = connect(ZMQ_DEALER, address + std::to_string(connection["shell_port"].get<int>()));
+            m_control = connect(ZMQ_DEALER, address + std::to_string(connection["control_port"].get<int>()));
+            m_iopub = connect(ZMQ_SUB, address + std::to_string(connection["iopub_port"].get<int>()));
+            zmq_setsockopt(m_iopub, ZMQ_SUBSCRIBE, "", 0);
+        }
+
+        client(const client&) = delete;
+        client& operator=(const client&) = delete;
+
+        ~client()
+        {
+            for (void* socket : {m_shell, m_control, m_iopub})
+            {
+                const int linger = 0;
+                zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+                zmq_close(socket);
+            }
+            zmq_ctx_term(m_context);
+        }
+
+        // Sends a request and returns its msg_id.
+        std::string send_shell(const std::string& msg_type, const nl::json& content)
+        {
+            return send(m_shell, msg_type, content);
+        }
+
+        std::string send_control(const std::string& msg_type, const nl::json& content)
+        {
+            return send(m_control, msg_type, content);
+        }
+
+        // Receives the next message of the shell (or control) channel and of the iopub
+        // channel, whichever comes first, until deadline.
+        std::optional<message> receive(bool& from_iopub, clock::time_point deadline,
+            bool control = false)
+        {
+            zmq_pollitem_t items[] = {{control ? m_control : m_shell, 0, ZMQ_POLLIN, 0},
+                {m_iopub, 0, ZMQ_POLLIN, 0}};
+            while (clock::now() < deadline)
+            {
+                const long timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - clock::now()).count();
+                if (zmq_poll(items, 2, std::max(timeout, 1L)) <= 0)
+                {
+                    continue;
+                }
+                from_iopub = !(items[0].revents & ZMQ_POLLIN);
+                return read(from_iopub ? m_iopub : items[0].socket);
+            }
+            return std::nullopt;
+        }
+
+        std::size_t signature_errors() const
+        {
+            return m_signature_errors;
+        }
+
+        private:
+
+        void* connect(int type, const std::string& address)
+        {
+            void* socket = zmq_socket(m_context, type);
+            if (socket == nullptr || zmq_connect(socket, address.c_str()) != 0)
+            {
+                throw std::runtime_error("could not connect to " + address);
+            }
+            return socket;
+        }
+
+        std::string sign(const std::string& header, const std::string& parent_header,
+            const std::string& metadata, const std::string& content) const
+        {
+            const std::string data = header + parent_header + metadata + content;
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int length = 0;
+            HMAC(EVP_sha256(), m_key.data(), static_cast<int>(m_key.size()),
+                reinterpret_cast<const unsigned char*>(data.data()), data.size(), digest,
+                &length);
+            static const char digits[] = "0123456789abcdef";
+            std::string res;
+            for (unsigned int i = 0; i < length; ++i)
+            {
+                res += digits[digest[i] >> 4];
+                res += digits[digest[i] & 15];
+            }
+            return res;
+        }
+
+        std::string send(void* socket, const std::string& msg_type, const nl::json& content)
+        {
+            const std::string msg_id = random_hex(32);
+            const std::string header = nl::json{{"msg_id", msg_id}, {"session", m_session},
+                {"username", "bench"}, {"date", utc_now()}, {"msg_type", msg_type},
+                {"version", "5.3"}}.dump();
+            const std::string parent_header = "{}";
+            const std::string metadata = "{}";
+            const std::string body = content.dump();
+            const std::vector<std::string> frames = {delimiter,
+                sign(header, parent_header, metadata, body), header, parent_header,
+                metadata, body};
+            for (std::size_t i = 0; i < frames.size(); ++i)
+            {
+                zmq_send(socket, frames[i].data(), frames[i].size(),
+                    (i + 1 < frames.size()) ? ZMQ_SNDMORE : 0);
+            }
+            return msg_id;
+        }
+
+        message read(void* socket)
+        {
+            std::vector<std::string> frames;
+            int more = 1;
+            while (more)
+            {
+                zmq_msg_t part;
+                zmq_msg_init(&part);
+                zmq_msg_recv(&part, socket, 0);
+                frames.emplace_back(static_cast<const char*>(zmq_msg_data(&part)),
+                    zmq_msg_size(&part));
+                more = zmq_msg_more(&part);
+                zmq_msg_close(&part);
+            }
+
+            message res;
+            for (const std::string& frame : frames)
+            {
+                res.bytes += frame.size();
+            }
+            auto found = std::find(frames.begin(), frames.end(), delimiter);
+            if (frames.end() - found < 6)
+            {
+                ++m_signature_errors;
+                return res;
+            }
+            if (found[1] != sign(found[2], found[3], found[4], found[5]))
+            {
+                ++m_signature_errors;
+            }
+            res.header = nl::json::parse(found[2]);
+            res.parent_header = nl::json::parse(found[3]);
+            res.content = nl::json::parse(found[5]);
+            return res;
+        }
+
+        std::string m_key;
+        std::string m_session;
+        void* m_context;
+        void* m_shell;
+        void* m_control;
+        void* m_iopub;
+        std::size_t m_signature_errors = 0;
+    };
+
+    // What a request has cost, from the frontend's point of view: it is done once its
+    // reply and the idle status of the kernel have been received.
+    struct sample
+    {
+        double latency_ms = 0;
+        std::size_t iopub_messages = 0;
+        std::size_t iopub_bytes = 0;
+        nl::json reply;
+    };
+
+    sample run_request(client& frontend, const std::string& msg_type, const nl::json& content)
+    {
+        sample res;
+        const clock::time_point start = clock::now();
+        const std::string msg_id = frontend.send_shell(msg_type, content);
+        const clock::time_point deadline = start + request_timeout;
+        bool replied = false;
+        bool idle = false;
+        while (!replied || !idle)
+        {
+            bool from_iopub = false;
+            std::optional<message> received = frontend.receive(from_iopub, deadline);
+            if (!received)
+            {
+                throw std::runtime_error(msg_type + " timed out");
+            }
+            if (received->parent_header.value("msg_id", "") != msg_id)
+            {
+                continue;
+            }
+            if (!from_iopub)
+            {
+                replied = true;
+                res.reply = received->content;
+            }
+            else
+            {
+                ++res.iopub_messages;
+                res.iopub_bytes += received->bytes;
+                idle = idle || (received->header.value("msg_type", "") == "status" &&
+                    received->content.value("execution_state", "") == "idle");
+            }
+        }
+        res.latency_ms = milliseconds_since(start);
+        return res;
+    }
+
+    nl::json execute_content(const std::string& code)
+    {
+        return {{"code", code}, {"silent", false}, {"store_history", true},
+            {"user_expressions", nl::json::object()}, {"allow_stdin", false},
+            {"stop_on_error", true}};
+    }
+
+    // The kernel keeps compiled the cells that declare nothing: the code of every
+    // repetition differs by a comment, so that each of them is compiled.
+    std::function<nl::json(std::size_t)> execute_each(const std::string& code)
+    {
+        return [code](std::size_t repetition)
+            {
+                return execute_content("// repetition " + std::to_string(repetition) +
+                    "\n" + code);
+            };
+    }
+
+    std::function<nl::json(std::size_t)> every_time(const nl::json& content)
+    {
+        return [content](std::size_t)
+            {
+                return content;
+            };
+    }
+
+    double percentile(std::vector<double> values, double p)
+    {
+        std::sort(values.begin(), values.end());
+        const std::size_t rank = static_cast<std::size_t>(std::ceil(p * values.size()));
+        return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+    }
+
+    // The distribution of latencies, as reported for the startup and every workload.
+    nl::json summarize(const std::vector<double>& latencies)
+    {
+        return {{"samples", latencies.size()},
+            {"p50_ms", percentile(latencies, 0.5)}, {"p99_ms", percentile(latencies, 0.99)},
+            {"min_ms", *std::min_element(latencies.begin(), latencies.end())},
+            {"mean_ms", std::accumulate(latencies.begin(), latencies.end(), 0.0) /
+                latencies.size()}};
+    }
+
+    struct workload
+    {
+        std::string name;
+        std::string msg_type;
+        // Content of the request of each repetition.
+        std::function<nl::json(std::size_t)> content;
+    };
+
+    nl::json run_workload(client& frontend, const workload& work, std::size_t repetitions)
+    {
+        std::vector<double> latencies;
+        std::size_t iopub_messages = 0;
+        std::size_t iopub_bytes = 0;
+        std::size_t compiled = 0;
+        double total_ms = 0;
+        for (std::size_t i = 0; i < repetitions; ++i)
+        {
+            const sample result = run_request(frontend, work.msg_type, work.content(i));
+            if (result.reply.value("status", "") != "ok")
+            {
+                throw std::runtime_error(work.name + " failed: " + result.reply.dump());
+            }
+            latencies.push_back(result.latency_ms);
+            iopub_messages += result.iopub_messages;
+            iopub_bytes += result.iopub_bytes;
+            total_ms += result.latency_ms;
+            if (result.reply.contains("als_xeus_cling") &&
+                result.reply["als_xeus_cling"].value("compiled", false))
+            {
+                ++compiled;
+            }
+        }
+
+        nl::json res = summarize(latencies);
+        res["name"] = work.name;
+        res["requests_per_s"] = 1000 * repetitions / total_ms;
+        res["iopub_messages_per_s"] = 1000 * iopub_messages / total_ms;
+        res["iopub_bytes_per_s"] = 1000 * iopub_bytes / total_ms;
+        if (work.msg_type == "execute_request")
+        {
+            // Repetitions served from the cells kept compiled.
+            res["compiled"] = compiled;
+        }
+        return res;
+    }
+
+    // A kernel started with a connection file of its own, on new ports, and the
+    // frontend connected to it. The kernel is shut down on destruction.
+    class kernel_process
+    {
+        public:
+
+        kernel_process(const std::string& kernel, std::size_t index):
+            m_connection{connection_to_free_ports()},
+            m_connection_file{write_connection_file(m_connection, index)},
+            m_frontend{m_connection},
+            m_launch{clock::now()},
+            m_pid{start(kernel, m_connection_file)}
+        {
+        }
+
+        kernel_process(const kernel_process&) = delete;
+        kernel_process& operator=(const kernel_process&) = delete;
+
+        ~kernel_process()
+        {
+            stop();
+            std::filesystem::remove(m_connection_file);
+        }
+
+        client& frontend()
+        {
+            return m_frontend;
+        }
+
+        // Waits until the kernel has started and returns the startup time: until the
+        // first reply. The iopub subscription only takes effect once the kernel has
+        // bound its socket, so we also wait until the kernel info requests are seen on
+        // iopub before measuring anything else.
+        double wait_until_started()
+        {
+            std::optional<double> res;
+            bool started = false;
+            while (!started)
+            {
+                if (waitpid(m_pid, nullptr, WNOHANG) == m_pid)
+                {
+                    throw std::runtime_error("the kernel has exited");
+                }
+                const std::string msg_id = m_frontend.send_shell("kernel_info_request",
+                    nl::json::object());
+                const clock::time_point deadline = clock::now() +
+                    std::chrono::milliseconds(500);
+                bool from_iopub = false;
+                while (std::optional<message> received = m_frontend.receive(from_iopub,
+                    deadline))
+                {
+                    if (!from_iopub && !res)
+                    {
+                        res = milliseconds_since(m_launch);
+                    }
+                    if (from_iopub && received->parent_header.value("msg_id", "") == msg_id)
+                    {
+                        started = true;
+                        break;
+                    }
+                }
+                if (!started && clock::now() - m_launch > request_timeout)
+                {
+                    throw std::runtime_error("the kernel did not start");
+                }
+            }
+            return *res;
+        }
+
+        private:
+
+        static nl::json connection_to_free_ports()
+        {
+            const std::vector<int> ports = free_ports(5);
+            return {{"transport", "tcp"}, {"ip", "127.0.0.1"},
+                {"shell_port", ports[0]}, {"iopub_port", ports[1]},
+                {"stdin_port", ports[2]}, {"control_port", ports[3]},
+                {"hb_port", ports[4]}, {"signature_scheme", "hmac-sha256"},
+                {"key", random_hex(64)}};
+        }
+
+        static std::string write_connection_file(const nl::json& connection,
+            std::size_t index)
+        {
+            const std::string res = (std::filesystem::temp_directory_path() /
+                ("kernel-bench-" + std::to_string(getpid()) + "-" + std::to_string(index) +
+                ".json")).string();
+            std::ofstream(res) << connection.dump();
+            return res;
+        }
+
+        static pid_t start(const std::string& kernel, const std::string& connection_file)
+        {
+            const pid_t pid = fork();
+            if (pid == 0)
+            {
+                // The standard output is left for the results.
+                dup2(STDERR_FILENO, STDOUT_FILENO);
+                execl(kernel.c_str(), kernel.c_str(), "-f", connection_file.c_str(),
+                    static_cast<char*>(nullptr));
+                std::perror(kernel.c_str());
+                _exit(127);
+            }
+            return pid;
+        }
+
+        void stop()
+        {
+            m_frontend.send_control("shutdown_request", {{"restart", false}});
+            const clock::time_point deadline = clock::now() + std::chrono::seconds(5);
+            while (clock::now() < deadline)
+            {
+                // It may also have been reaped already.
+                if (waitpid(m_pid, nullptr, WNOHANG) != 0)
+                {
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            kill(m_pid, SIGKILL);
+            waitpid(m_pid, nullptr, 0);
+        }
+
+        nl::json m_connection;
+        std::string m_connection_file;
+        client m_frontend;
+        clock::time_point m_launch;
+        pid_t m_pid;
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <kernel executable> [repetitions] [startups]"
+            << std::endl;
+        return 2;
+    }
+    const std::string kernel = argv[1];
+    const std::size_t repetitions = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 20;
+    const std::size_t startups = std::max<std::size_t>(1,
+        (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 5);
+
+    nl::json res;
+    res["kernel"] = kernel;
+    res["repetitions"] = repetitions;
+
+    std::size_t signature_errors = 0;
+    std::optional<kernel_process> benchmarked;
+    int status = 0;
+    try
+    {
+        // Every startup is measured with a kernel of its own; the workloads run on the
+        // last one.
+        std::vector<double> startup_latencies;
+        for (std::size_t i = 1; i < startups; ++i)
+        {
+            kernel_process started(kernel, i);
+            startup_latencies.push_back(started.wait_until_started());
+            signature_errors += started.frontend().signature_errors();
+        }
+        benchmarked.emplace(kernel, startups);
+        startup_latencies.push_back(benchmarked->wait_until_started());
+        res["startup"] = summarize(startup_latencies);
+        client& frontend = benchmarked->frontend();
+
+        const sample setup = run_request(frontend, "execute_request", execute_content(
+            "#include <iostream>\n"
+            "#include <vector>\n"
+            "std::vector<std::vector<double>> bench_matrix(100, std::vector<double>(100, 1.5));"));
+        if (setup.reply.value("status", "") != "ok")
+        {
+            throw std::runtime_error("setup failed: " + setup.reply.dump());
+        }
+
+        const std::vector<workload> workloads = {
+            {"execute_trivial", "execute_request", execute_each("1 + 1;")},
+            {"execute_trivial_cached", "execute_request",
+                every_time(execute_content("1 + 1;"))},
+            {"display_scalar", "execute_request", execute_each("42")},
+            {"display_matrix", "execute_request", execute_each("bench_matrix")},
+            {"complete_std", "complete_request",
+                every_time({{"code", "std::"}, {"cursor_pos", 5}})},
+            {"display_plain_10k", "execute_request", execute_each(
+                "for (int i = 0; i < 10000; ++i) { als::xeus_cling::display_plain(i); }")},
+            {"stdout_large", "execute_request", execute_each(
+                "for (int i = 0; i < 100000; ++i) { std::cout << i << '\\n'; }")}};
+        res["workloads"] = nl::json::array();
+        for (const workload& work : workloads)
+        {
+            res["workloads"].push_back(run_workload(frontend, work, repetitions));
+        }
+    }
+    catch (const std::exception& e)
+    {
+        res["error"] = e.what();
+        status = 1;
+    }
+
+    if (benchmarked)
+    {
+        signature_errors += benchmarked->frontend().signature_errors();
+        benchmarked.reset();
+    }
+    res["signature_errors"] = signature_errors;
+    if (signature_errors != 0)
+    {
+        status = 1;
+    }
+    std::cout << res.dump(2) << std::endl;
+    return status;
+}
@@ -8,10 +8,15 @@
 
 
 
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #ifdef __GNUC__
 #include <stdio.h>
@@ -21,11 +26,20 @@
 #include <unistd.h>
 #endif
 
+#include "xeus/xguid.hpp"
+#include "xeus/xhelper.hpp"
 #include "xeus/xkernel.hpp"
 #include "xeus/xkernel_configuration.hpp"
+#include "xeus/xmessage.hpp"
+#include "xeus/xserver.hpp"
 #include "xeus-zmq/xserver_zmq.hpp"
 
+#include "xbatch.hpp"
+#include "xcapture.hpp"
 #include "xinterpreter.hpp"
+#include "xinterrupt.hpp"
+#include "xoptions.hpp"
+#include "xpool.hpp"
 #include "als-xeus-cling-config.hpp"
 
 
@@ -75,34 +89,62 @@ std::string extract_filename(int argc, char* argv[])
     return res;
 }
 
+using interpreter_ptr = std::unique_ptr<als::xeus_cling::interpreter>;
 
-
-int main(int argc, char* argv[])
-{    
-    if (should_print_version(argc, argv))
-    {
-        std::clog << "als-xeus-cling-kernel " << ALS_XEUS_CLING_VERSION  << std::endl;
-        return 0;
-    }
-
-    // If we are called from the Jupyter launcher, silence all logging. This
-    // is important for a JupyterHub configured with cleanup_servers = False:
-    // Upon restart, spawned single-user servers keep running but without the
-    // std* streams. When a user then tries to start a new kernel, als-xeus-cling-kernel
-    // will get a SIGPIPE and exit.
+// If we are called from the Jupyter launcher, silence all logging. This
+// is important for a JupyterHub configured with cleanup_servers = False:
+// Upon restart, spawned single-user servers keep running but without the
+// std* streams. When a user then tries to start a new kernel, als-xeus-cling-kernel
+// will get a SIGPIPE and exit.
+void silence_logging_if_launched()
+{
     if (std::getenv("JPY_PARENT_PID") != NULL)
     {
         std::clog.setstate(std::ios_base::failbit);
     }
+}
 
-    auto context = xeus::make_context<zmq::context_t>();
-
-    // Instantiating the xeus xinterpreter
-    using interpreter_ptr = std::unique_ptr<als::xeus_cling::interpreter>;
-    interpreter_ptr interpreter = interpreter_ptr(new als::xeus_cling::interpreter());
+// The journal of a kernel is named after its connection file, which Jupyter keeps
+// when it restarts the kernel.
+void open_journal(als::xeus_cling::interpreter& interpreter,
+    const std::string& directory, const std::string& connection_filename)
+{
+    if (!directory.empty() && !connection_filename.empty())
+    {
+        interpreter.open_journal((std::filesystem::path(directory) /
+            std::filesystem::path(connection_filename).stem()).string() + ".journal");
+    }
+}
 
+// What the threads of a cell publish once it has finished is sent on IOPub under the
+// parent header of the cell, so that the frontend shows it there.
+void register_parented_publisher(als::xeus_cling::interpreter& interpreter,
+    xeus::xkernel& kernel)
+{
+    interpreter.register_parented_publisher(
+        [&kernel, username = xeus::get_user_name(), session = xeus::new_xguid()](
+            const std::string& msg_type, nl::json parent_header, nl::json metadata,
+            nl::json content, xeus::buffer_sequence buffers)
+        {
+            nl::json header;
+            header["msg_id"] = xeus::new_xguid();
+            header["username"] = username;
+            header["session"] = session;
+            header["date"] = xeus::iso8601_now();
+            header["msg_type"] = msg_type;
+            header["version"] = "5.3";
+            kernel.get_server().publish(xeus::xpub_message(msg_type, std::move(header),
+                std::move(parent_header), std::move(metadata), std::move(content),
+                std::move(buffers)), xeus::channel::SHELL);
+        });
+}
 
-    std::string connection_filename = extract_filename(argc, argv);
+int start_kernel(interpreter_ptr interpreter, const std::string& connection_filename,
+    const std::string& journal_directory)
+{
+    open_journal(*interpreter, journal_directory, connection_filename);
+    als::xeus_cling::interpreter& kernel_interpreter = *interpreter;
+    auto context = xeus::make_context<zmq::context_t>();
 
     if (!connection_filename.empty())
     {
@@ -110,6 +152,7 @@ int main(int argc, char* argv[])
         xeus::xconfiguration config = xeus::load_configuration(connection_filename);
         xeus::xkernel kernel(config, xeus::get_user_name(), std::move(context),
             std::move(interpreter), xeus::make_xserver_zmq);
+        register_parented_publisher(kernel_interpreter, kernel);
 
         std::cout <<
             "Starting als-xeus-cling-kernel kernel...\n\n"
@@ -123,6 +166,7 @@ int main(int argc, char* argv[])
     {
         xeus::xkernel kernel(xeus::get_user_name(), std::move(context),
             std::move(interpreter), xeus::make_xserver_zmq);
+        register_parented_publisher(kernel_interpreter, kernel);
 
         const auto& config = kernel.get_config();
         std::cout <<
@@ -148,3 +192,93 @@ int main(int argc, char* argv[])
 
     return 0;
 }
+
+int main(int argc, char* argv[])
+{    
+    // The C output of the cells is captured through a pipe, into which stdout would be
+    // fully buffered. The buffering can only be set before stdout is used.
+    std::setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+    // The log of the kernel does not go into the output of the cells while the
+    // standard error is captured.
+    als::xeus_cling::separate_kernel_log();
+
+    if (should_print_version(argc, argv))
+    {
+        std::clog << "als-xeus-cling-kernel " << ALS_XEUS_CLING_VERSION  << std::endl;
+        return 0;
+    }
+
+    silence_logging_if_launched();
+
+#ifdef __GNUC__
+    signal(SIGSEGV, handler);
+#endif
+    // Jupyter interrupts the kernel with SIGINT. This must be done before any thread is
+    // created: only the thread executing the cells handles it.
+    als::xeus_cling::install_interrupt_handler();
+
+    const als::xeus_cling::kernel_options options =
+        als::xeus_cling::parse_options(argc, argv);
+    std::string connection_filename = extract_filename(argc, argv);
+
+    // The kernel is taken from a pool if one is running, and started here otherwise.
+    if (!options.attach_socket.empty())
+    {
+        if (std::optional<int> exit_status = als::xeus_cling::attach_to_pool(
+            options.attach_socket, connection_filename, options))
+        {
+            return *exit_status;
+        }
+        std::clog << "als-xeus-cling-kernel: no kernel from the pool on "
+            << options.attach_socket << ", starting the kernel" << std::endl;
+    }
+
+    // Instantiating the xeus xinterpreter
+    interpreter_ptr interpreter = interpreter_ptr(new als::xeus_cling::interpreter(
+        options));
+
+    // Notebooks are executed without starting a kernel.
+    if (!options.execute_notebooks.empty())
+    {
+        if (!options.notebook_output.empty() && options.execute_notebooks.size() > 1)
+        {
+            std::clog << "als-xeus-cling-kernel: --output is ignored when several "
+                "notebooks are executed" << std::endl;
+        }
+        std::vector<als::xeus_cling::notebook_job> jobs;
+        for (const std::string& input : options.execute_notebooks)
+        {
+            jobs.push_back({input, (options.execute_notebooks.size() == 1 &&
+                !options.notebook_output.empty()) ? options.notebook_output :
+                als::xeus_cling::default_notebook_output(input)});
+        }
+        // Everything the notebooks share is done once, before they are forked.
+        interpreter->preload();
+        return als::xeus_cling::run_notebooks(*interpreter, jobs, options.notebook_jobs);
+    }
+
+    if (!options.pool_socket.empty())
+    {
+        // Everything the kernels share is done once, before they are forked.
+        interpreter->preload();
+        return als::xeus_cling::run_pool(options.pool_socket, options.pool_size,
+            std::chrono::seconds(options.pool_recycle), argv,
+            als::xeus_cling::interpreter_flags(options),
+            [&interpreter](const std::string& connection_file,
+                const std::string& journal_directory)
+            {
+                // The kernel runs in the directory of its launcher, and journals where
+                // the launcher has been told to. Its log goes to the standard error of
+                // the launcher from now on.
+                als::xeus_cling::separate_kernel_log();
+                silence_logging_if_launched();
+                interpreter->cling_interpreter.AddIncludePath(
+                    std::filesystem::current_path().string());
+                return start_kernel(std::move(interpreter), connection_file,
+                    journal_directory);
+            });
+    }
+
+    return start_kernel(std::move(interpreter), connection_filename,
+        options.journal_directory);
+}
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "xbatch.hpp"
+
+namespace
+{
+    // Source of a cell, which nbformat allows to split into lines.
+    std::string cell_source(const nl::json& cell)
+    {
+        const auto source = cell.find("source");
+        if (source == cell.end())
+        {
+            return "";
+        }
+        if (source->is_array())
+        {
+            std::string res;
+            for (const nl::json& line : *source)
+            {
+                res += line.get<std::string>();
+            }
+            return res;
+        }
+        return source->is_string() ? source->get<std::string>() : "";
+    }
+
+    // Turns what the interpreter publishes while a cell runs into the outputs of the
+    // cell, as a frontend would.
+    class output_recorder
+    {
+        public:
+
+        explicit output_recorder(nl::json& outputs):
+            m_outputs{outputs}
+        {
+        }
+
+        void record(const std::string& msg_type, const nl::json& content)
+        {
+            if (msg_type == "clear_output")
+            {
+                // With wait, the outputs are cleared when the next one arrives.
+                m_clear_pending = true;
+                if (!content.value("wait", false))
+                {
+                    clear();
+                }
+                return;
+            }
+            if (msg_type == "update_display_data")
+            {
+                const std::string display_id = content["transient"].value("display_id", "");
+                for (std::size_t index : m_displays[display_id])
+                {
+                    m_outputs[index]["data"] = content["data"];
+                    m_outputs[index]["metadata"] = content["metadata"];
+                }
+                return;
+            }
+            if (msg_type != "stream" && msg_type != "display_data" &&
+                msg_type != "execute_result" && msg_type != "error")
+            {
+                return;
+            }
+            if (m_clear_pending)
+            {
+                clear();
+            }
+
+            // Consecutive writes into the same stream are merged, as nbconvert does.
+            if (msg_type == "stream" && !m_outputs.empty() &&
+                m_outputs.back()["output_type"] == "stream" &&
+                m_outputs.back()["name"] == content["name"])
+            {
+                m_outputs.back()["text"] = m_outputs.back()["text"].get<std::string>() +
+                    content["text"].get<std::string>();
+                return;
+            }
+
+            nl::json output;
+            output["output_type"] = msg_type;
+            if (msg_type == "stream")
+            {
+                output["name"] = content["name"];
+                output["text"] = content["text"];
+            }
+            else if (msg_type == "error")
+            {
+                output["ename"] = content["ename"];
+                output["evalue"] = content["evalue"];
+                output["traceback"] = content["traceback"];
+            }
+            else
+            {
+                if (msg_type == "execute_result")
+                {
+                    output["execution_count"] = content["execution_count"];
+                }
+                output["data"] = content["data"];
+                output["metadata"] = content.value("metadata", nl::json::object());
+                if (content.contains("transient"))
+                {
+                    const std::string display_id = content["transient"].value("display_id", "");
+                    if (!display_id.empty())
+                    {
+                        m_displays[display_id].push_back(m_outputs.size());
+                    }
+                }
+            }
+            m_outputs.push_back(std::move(output));
+        }
+
+        private:
+
+        void clear()
+        {
+            m_outputs = nl::json::array();
+            m_displays.clear();
+            m_clear_pending = false;
+        }
+
+        nl::json& m_outputs;
+        // Indexes of the outputs of each display id, to be updated.
+        std::map<std::string, std::vector<std::size_t>> m_displays;
+        bool m_clear_pending = false;
+    };
+
+    // Executes a notebook in a forked copy of the batch process. Returns its exit status.
+    int execute_notebook_file(als::xeus_cling::interpreter& interpreter,
+        const als::xeus_cling::notebook_job& job)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const std::filesystem::path input_path = std::filesystem::absolute(job.input);
+        const std::filesystem::path output_path = std::filesystem::absolute(job.output);
+
+        std::ifstream input(input_path);
+        nl::json notebook = nl::json::parse(input, nullptr, false);
+        if (notebook.is_discarded() || !notebook.contains("cells"))
+        {
+            std::clog << "als-xeus-cling-kernel: could not read the notebook " << job.input
+                << std::endl;
+            return 1;
+        }
+
+        // The notebook runs in its directory, as in Jupyter.
+        std::error_code error;
+        std::filesystem::current_path(input_path.parent_path(), error);
+        interpreter.cling_interpreter.AddIncludePath(
+            std::filesystem::current_path().string());
+
+        const bool succeeded = als::xeus_cling::execute_notebook(interpreter, notebook);
+
+        std::ofstream output(output_path);
+        output << notebook.dump(1) << "\n";
+        output.close();
+        if (!output)
+        {
+            std::clog << "als-xeus-cling-kernel: could not write " << job.output << std::endl;
+            return 1;
+        }
+
+        std::clog << "als-xeus-cling-kernel: executed " << job.input << " in "
+            << std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count() << " ms"
+            << (succeeded ? "" : " (stopped at a cell that failed)") << std::endl;
+        return succeeded ? 0 : 1;
+    }
+}
+
+namespace als::xeus_cling
+{
+    std::string default_notebook_output(const std::string& input)
+    {
+        const std::string extension = ".ipynb";
+        const bool has_extension = input.size() >= extension.size() &&
+            input.compare(input.size() - extension.size(), extension.size(), extension) == 0;
+        return (has_extension ? input.substr(0, input.size() - extension.size()) : input) +
+            ".nbconvert.ipynb";
+    }
+
+    bool execute_notebook(interpreter& interpreter, nl::json& notebook)
+    {
+        std::unique_ptr<output_recorder> recorder;
+        interpreter.register_publisher([&recorder](const std::string& msg_type, nl::json,
+            nl::json content, xeus::buffer_sequence)
+            {
+                if (recorder != nullptr)
+                {
+                    recorder->record(msg_type, content);
+                }
+            });
+
+        int execution_count = 0;
+        bool failed = false;
+        for (nl::json& cell : notebook["cells"])
+        {
+            if (cell.value("cell_type", "") != "code")
+            {
+                continue;
+            }
+            cell["outputs"] = nl::json::array();
+            cell["execution_count"] = nullptr;
+
+            // Like nbconvert, empty cells are not executed.
+            const std::string code = cell_source(cell);
+            if (failed || code.find_first_not_of(" \t\r\n") == std::string::npos)
+            {
+                continue;
+            }
+
+            recorder = std::make_unique<output_recorder>(cell["outputs"]);
+            ++execution_count;
+            const nl::json reply = interpreter.execute_request_impl(execution_count, code,
+                false, true, nl::json::object(), false);
+            recorder.reset();
+            cell["execution_count"] = execution_count;
+            failed = reply.value("status", "") != "ok";
+        }
+        return !failed;
+    }
+
+    int run_notebooks(interpreter& interpreter, const std::vector<notebook_job>& jobs,
+        std::size_t parallel)
+    {
+        parallel = std::max<std::size_t>(parallel, 1);
+        std::map<pid_t, const notebook_job*> running;
+        std::size_t next = 0;
+        int status = 0;
+        while (next < jobs.size() || !running.empty())
+        {
+            while (next < jobs.size() && running.size() < parallel)
+            {
+                const notebook_job& job = jobs[next++];
+                const pid_t pid = fork();
+                if (pid == -1)
+                {
+                    std::clog << "als-xeus-cling-kernel: could not fork to execute "
+                        << job.input << std::endl;
+                    status = 1;
+                    continue;
+                }
+                if (pid == 0)
+                {
+                    // The copy does not return into main, whose objects belong to the
+                    // batch process.
+                    const int exit_status = execute_notebook_file(interpreter, job);
+                    std::cout.flush();
+                    std::clog.flush();
+                    _exit(exit_status);
+                }
+                running.emplace(pid, &job);
+            }
+            if (running.empty())
+            {
+                continue;
+            }
+
+            int child_status = 0;
+            const pid_t pid = waitpid(-1, &child_status, 0);
+            if (pid == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            auto finished = running.find(pid);
+            if (finished == running.end())
+            {
+                continue;
+            }
+            if (WIFSIGNALED(child_status))
+            {
+                std::clog << "als-xeus-cling-kernel: the execution of "
+                    << finished->second->input << " was killed by signal "
+                    << WTERMSIG(child_status) << std::endl;
+            }
+            if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0)
+            {
+                status = 1;
+            }
+            running.erase(finished);
+        }
+        return status;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef ALS_XEUS_CLING_XBATCH_HPP
+#define ALS_XEUS_CLING_XBATCH_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xinterpreter.hpp"
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief A notebook to execute, and where to write it once executed.
+     *
+     */
+    struct notebook_job
+    {
+        std::string input;
+        std::string output;
+    };
+
+    /**
+     * @brief Returns where a notebook is written once executed by default: next to it,
+     * with the extension .nbconvert.ipynb, as jupyter nbconvert --execute does.
+     *
+     */
+    std::string default_notebook_output(const std::string& input);
+
+    /**
+     * @brief Executes the code cells of a notebook in order, in the calling thread, and
+     * replaces their outputs and execution counts with the new ones. The execution stops
+     * at the first cell that fails; the cells after it are left without outputs.
+     *
+     * @param interpreter Interpreter executing the cells. It is not configured, so the
+     * cells can not open comms.
+     * @param notebook The notebook, in the nbformat 4 format.
+     * @return true if every cell succeeded.
+     */
+    bool execute_notebook(interpreter& interpreter, nl::json& notebook);
+
+    /**
+     * @brief Executes notebooks without a frontend. Every notebook is executed in a copy
+     * of the calling process forked from interpreter, in the directory of the notebook,
+     * so the notebooks share what interpreter has loaded (the precompiled prelude and the
+     * preloaded libraries and headers) but not their state.
+     *
+     * Must be called from the main thread, before any other thread is created.
+     *
+     * @param interpreter Interpreter, already preloaded.
+     * @param jobs The notebooks.
+     * @param parallel Maximum number of notebooks executed at the same time.
+     * @return int Exit status: 0 if every notebook has been executed without error.
+     */
+    int run_notebooks(interpreter& interpreter, const std::vector<notebook_job>& jobs,
+        std::size_t parallel);
+}
+
+#endif // ALS_XEUS_CLING_XBATCH_HPP
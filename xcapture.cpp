@@ -0,0 +1,297 @@
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "xcapture.hpp"
+
+namespace
+{
+    // Size of the chunks read from the pipe. Under heavy output, several reads are
+    // merged into one chunk before it is forwarded.
+    constexpr std::size_t chunk_size = 64 * 1024;
+
+    void close_fd(int& fd)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    bool write_all(int fd, const char* data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            const ssize_t count = write(fd, data, size);
+            if (count == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    // Writes into a file descriptor, without buffering.
+    class fd_streambuf : public std::streambuf
+    {
+        public:
+
+        void reset(int fd)
+        {
+            close_fd(m_fd);
+            m_fd = fd;
+        }
+
+        protected:
+
+        int_type overflow(int_type c) override
+        {
+            if (traits_type::eq_int_type(c, traits_type::eof()))
+            {
+                return traits_type::not_eof(c);
+            }
+            const char character = traits_type::to_char_type(c);
+            return write_all(m_fd, &character, 1) ? c : traits_type::eof();
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override
+        {
+            return write_all(m_fd, s, n) ? n : 0;
+        }
+
+        private:
+
+        int m_fd = -1;
+    };
+}
+
+namespace als::xeus_cling
+{
+    fd_capture::fd_capture(int fd, publisher publish):
+        m_fd{fd},
+        m_publish{std::move(publish)},
+        m_saved_fd{-1},
+        m_pipe_read{-1},
+        m_stop_read{-1},
+        m_stop_write{-1}
+    {
+    }
+
+    fd_capture::~fd_capture()
+    {
+        stop();
+    }
+
+    bool fd_capture::start()
+    {
+        if (m_reader.joinable())
+        {
+            return true;
+        }
+
+        int output_pipe[2];
+        int stop_pipe[2];
+        if (pipe(output_pipe) != 0)
+        {
+            return false;
+        }
+        if (pipe(stop_pipe) != 0)
+        {
+            close(output_pipe[0]);
+            close(output_pipe[1]);
+            return false;
+        }
+
+        std::fflush(stdout);
+        std::fflush(stderr);
+        m_saved_fd = dup(m_fd);
+        if (m_saved_fd == -1 || dup2(output_pipe[1], m_fd) == -1)
+        {
+            close_fd(m_saved_fd);
+            close(output_pipe[0]);
+            close(output_pipe[1]);
+            close(stop_pipe[0]);
+            close(stop_pipe[1]);
+            return false;
+        }
+        close(output_pipe[1]);
+
+        m_pipe_read = output_pipe[0];
+        m_stop_read = stop_pipe[0];
+        m_stop_write = stop_pipe[1];
+        m_reader = std::thread(&fd_capture::read_loop, this);
+        return true;
+    }
+
+    void fd_capture::stop()
+    {
+        if (!m_reader.joinable())
+        {
+            return;
+        }
+
+        std::fflush(stdout);
+        std::fflush(stderr);
+        dup2(m_saved_fd, m_fd);
+        close_fd(m_saved_fd);
+
+        // The write end of the pipe may still be open elsewhere (for example, in a
+        // process spawned by the cell), so we can not wait for end of file: we tell the
+        // reader to forward what is left and finish.
+        const char stop_byte = 0;
+        while (write(m_stop_write, &stop_byte, 1) == -1 && errno == EINTR)
+        {
+        }
+        m_reader.join();
+
+        close_fd(m_pipe_read);
+        close_fd(m_stop_read);
+        close_fd(m_stop_write);
+    }
+
+    void fd_capture::read_loop()
+    {
+        std::string chunk(chunk_size, '\0');
+        bool stopping = false;
+
+        while (true)
+        {
+            pollfd fds[2] = {{m_pipe_read, POLLIN, 0}, {m_stop_read, POLLIN, 0}};
+            // Once we have been asked to stop, we only take what is already there.
+            if (poll(fds, stopping ? 1 : 2, stopping ? 0 : -1) == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+
+            if (!stopping && (fds[1].revents & POLLIN))
+            {
+                stopping = true;
+            }
+
+            if (!(fds[0].revents & (POLLIN | POLLHUP)))
+            {
+                if (stopping)
+                {
+                    break;
+                }
+                continue;
+            }
+
+            // We merge everything that is immediately available into one chunk.
+            std::size_t size = 0;
+            while (size < chunk.size())
+            {
+                ssize_t count = read(m_pipe_read, &chunk[size], chunk.size() - size);
+                if (count <= 0)
+                {
+                    break;
+                }
+                size += count;
+
+                pollfd more = {m_pipe_read, POLLIN, 0};
+                if (poll(&more, 1, 0) <= 0 || !(more.revents & POLLIN))
+                {
+                    break;
+                }
+            }
+
+            if (size == 0)
+            {
+                // End of file: every writer has closed the pipe.
+                break;
+            }
+            m_publish(chunk.substr(0, size));
+        }
+    }
+
+    output_capture::output_capture(publisher publish_output, publisher publish_error,
+        const output_limits& limits):
+        m_output{publish_output, limits},
+        m_error{publish_error, limits},
+        // What is written into the file descriptors counts against the same limits.
+        m_fd_output{STDOUT_FILENO, [this](const std::string& text)
+            {
+                m_output.write_through(text);
+            }},
+        m_fd_error{STDERR_FILENO, [this](const std::string& text)
+            {
+                m_error.write_through(text);
+            }},
+        m_old_output{nullptr},
+        m_old_error{nullptr}
+    {
+    }
+
+    output_capture::~output_capture()
+    {
+        stop();
+    }
+
+    void output_capture::start()
+    {
+        if (m_old_output != nullptr)
+        {
+            return;
+        }
+
+        m_old_output = std::cout.rdbuf(&m_output);
+        m_old_error = std::cerr.rdbuf(&m_error);
+        m_fd_output.start();
+        m_fd_error.start();
+    }
+
+    void output_capture::stop()
+    {
+        if (m_old_output == nullptr)
+        {
+            return;
+        }
+
+        std::cout.rdbuf(m_old_output);
+        std::cerr.rdbuf(m_old_error);
+        m_old_output = nullptr;
+        m_old_error = nullptr;
+        m_fd_output.stop();
+        m_fd_error.stop();
+        m_output.finish();
+        m_error.finish();
+    }
+
+    output_stream& output_capture::error()
+    {
+        return m_error;
+    }
+
+    void separate_kernel_log()
+    {
+        // Never destroyed, since std::clog may be used until the very end.
+        static fd_streambuf* log = new fd_streambuf;
+        const int fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            return;
+        }
+        log->reset(fd);
+        // rdbuf clears the state of the stream, e.g. of a log silenced by the launcher.
+        const std::ios_base::iostate state = std::clog.rdstate();
+        std::clog.rdbuf(log);
+        std::clog.setstate(state);
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef ALS_XEUS_CLING_XCAPTURE_HPP
+#define ALS_XEUS_CLING_XCAPTURE_HPP
+
+#include <functional>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+#include "xstream.hpp"
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Captures everything written into a file descriptor (typically 1 or 2), e.g.
+     * by printf, puts or native libraries, and forwards it to a publisher.
+     *
+     * While capturing, the file descriptor is redirected onto a pipe which is read by a
+     * dedicated thread. The thread forwards whole chunks, so writers never wait for the
+     * publication and there is no locking per byte.
+     *
+     */
+    class fd_capture
+    {
+        public:
+
+        using publisher = std::function<void(const std::string& text)>;
+
+        /**
+         * @brief Construct a new fd capture. It does not start capturing.
+         *
+         * @param fd File descriptor to capture.
+         * @param publish Function called from the reader thread with every chunk.
+         */
+        fd_capture(int fd, publisher publish);
+        fd_capture(const fd_capture&) = delete;
+        fd_capture& operator=(const fd_capture&) = delete;
+        ~fd_capture();
+
+        /**
+         * @brief Redirects the file descriptor onto the pipe and starts the reader
+         * thread. Returns false if the redirection could not be set up.
+         *
+         */
+        bool start();
+
+        /**
+         * @brief Flushes the C streams, restores the file descriptor and waits until
+         * everything that was written has been forwarded.
+         *
+         */
+        void stop();
+
+        private:
+
+        void read_loop();
+
+        int m_fd;
+        publisher m_publish;
+        int m_saved_fd;
+        int m_pipe_read;
+        // Written by stop() to wake up the reader thread.
+        int m_stop_read;
+        int m_stop_write;
+        std::thread m_reader;
+    };
+
+    /**
+     * @brief Captures everything a cell writes, through std::cout and std::cerr (into
+     * output_streams) as well as directly into the file descriptors 1 and 2 (printf,
+     * native libraries, cling diagnostics...), and publishes it while the cell runs.
+     *
+     */
+    class output_capture
+    {
+        public:
+
+        using publisher = std::function<void(const std::string& text)>;
+
+        /**
+         * @brief Construct a new output capture. It does not start capturing.
+         *
+         * @param publish_output Function publishing what is written into the output.
+         * @param publish_error Function publishing what is written into the error output.
+         * @param limits Limits applied to each output, whether it is written through
+         * std::cout and std::cerr or into the file descriptors.
+         */
+        output_capture(publisher publish_output, publisher publish_error,
+            const output_limits& limits);
+        output_capture(const output_capture&) = delete;
+        output_capture& operator=(const output_capture&) = delete;
+        ~output_capture();
+
+        /**
+         * @brief Redirects std::cout, std::cerr and the file descriptors. It can be
+         * called again after stop.
+         *
+         */
+        void start();
+
+        /**
+         * @brief Restores std::cout, std::cerr and the file descriptors, and publishes
+         * what is left.
+         *
+         */
+        void stop();
+
+        /**
+         * @brief The stream std::cerr is redirected into, e.g. to build error messages.
+         *
+         */
+        output_stream& error();
+
+        private:
+
+        output_stream m_output;
+        output_stream m_error;
+        fd_capture m_fd_output;
+        fd_capture m_fd_error;
+        std::streambuf* m_old_output;
+        std::streambuf* m_old_error;
+    };
+
+    /**
+     * @brief Makes std::clog write into a duplicate of the current standard error, so
+     * that the log of the kernel never goes into the output of a cell, even while the
+     * file descriptor 2 is captured. Called at startup, before any other use of
+     * std::clog, and again when the standard error changes (see run_pool).
+     *
+     */
+    void separate_kernel_log();
+}
+
+#endif // ALS_XEUS_CLING_XCAPTURE_HPP
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "xcompletion.hpp"
+
+namespace
+{
+    bool is_identifier_char(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_';
+    }
+
+    // Appends the type of a parameter placeholder, i.e., its contents without the name
+    // of the parameter and without trailing spaces.
+    void append_placeholder_type(std::string& res, std::string_view placeholder)
+    {
+        std::size_t end = placeholder.size();
+        while (end > 0 && placeholder[end - 1] == ' ')
+        {
+            --end;
+        }
+
+        // The name is the trailing identifier, provided it is separated from the type
+        // by spaces or stars ("int x", "char *s"). Otherwise it is the type ("T").
+        std::size_t name_start = end;
+        while (name_start > 0 && is_identifier_char(placeholder[name_start - 1]))
+        {
+            --name_start;
+        }
+        if (name_start > 0 && name_start < end &&
+            (placeholder[name_start - 1] == ' ' || placeholder[name_start - 1] == '*'))
+        {
+            end = name_start;
+            while (end > 0 && placeholder[end - 1] == ' ')
+            {
+                --end;
+            }
+        }
+
+        res.append(placeholder.substr(0, end));
+    }
+
+    // The name a completion introduces, e.g., foo for foo(int, double).
+    std::string_view leading_identifier(std::string_view completion)
+    {
+        std::size_t end = 0;
+        while (end < completion.size() && is_identifier_char(completion[end]))
+        {
+            ++end;
+        }
+        return completion.substr(0, end);
+    }
+
+    // Tells whether name appears in code as a whole word.
+    bool contains_word(std::string_view code, std::string_view name)
+    {
+        if (name.empty())
+        {
+            return false;
+        }
+        for (std::size_t i = code.find(name); i != std::string_view::npos;
+            i = code.find(name, i + 1))
+        {
+            const std::size_t end = i + name.size();
+            if ((i == 0 || !is_identifier_char(code[i - 1])) &&
+                (end == code.size() || !is_identifier_char(code[end])))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+namespace als::xeus_cling
+{
+    std::string format_completion(std::string_view completion)
+    {
+        std::string res;
+        res.reserve(completion.size());
+
+        std::size_t i = 0;
+        while (i < completion.size())
+        {
+            if (completion.compare(i, 2, "[#") == 0)
+            {
+                // The result type is dropped.
+                std::size_t end = completion.find("#]", i + 2);
+                if (end == std::string_view::npos)
+                {
+                    break;
+                }
+                i = end + 2;
+            }
+            else if (completion.compare(i, 2, "<#") == 0)
+            {
+                std::size_t end = completion.find("#>", i + 2);
+                if (end == std::string_view::npos)
+                {
+                    res.append(completion.substr(i));
+                    break;
+                }
+                append_placeholder_type(res, completion.substr(i + 2, end - i - 2));
+                i = end + 2;
+            }
+            else
+            {
+                res.push_back(completion[i]);
+                ++i;
+            }
+        }
+
+        return res;
+    }
+
+    std::vector<std::string> rank_completions(std::vector<std::string> completions,
+        std::string_view code, const std::function<bool(std::string_view)>& is_user_declaration,
+        std::size_t max_count)
+    {
+        auto user_end = std::stable_partition(completions.begin(), completions.end(),
+            [&](const std::string& completion)
+            {
+                std::string_view name = leading_identifier(completion);
+                return contains_word(code, name) || is_user_declaration(name);
+            });
+        std::stable_partition(completions.begin(), user_end,
+            [&](const std::string& completion)
+            {
+                return contains_word(code, leading_identifier(completion));
+            });
+
+        if (completions.size() > max_count)
+        {
+            completions.resize(max_count);
+        }
+        return completions;
+    }
+
+    bool completion_cache::lookup(std::size_t generation, std::string_view context,
+        std::string_view prefix, std::vector<std::string>& completions) const
+    {
+        if (!m_valid || generation != m_generation || context != m_context ||
+            prefix.substr(0, m_prefix.size()) != m_prefix)
+        {
+            return false;
+        }
+
+        completions.clear();
+        for (auto it = std::lower_bound(m_completions.begin(), m_completions.end(), prefix);
+            it != m_completions.end() && std::string_view(*it).substr(0, prefix.size()) == prefix;
+            ++it)
+        {
+            completions.push_back(*it);
+        }
+        return true;
+    }
+
+    void completion_cache::store(std::size_t generation, std::string_view context,
+        std::string_view prefix, std::vector<std::string> completions)
+    {
+        std::sort(completions.begin(), completions.end());
+        m_valid = true;
+        m_generation = generation;
+        m_context = context;
+        m_prefix = prefix;
+        m_completions = std::move(completions);
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef ALS_XEUS_CLING_XCOMPLETION_HPP
+#define ALS_XEUS_CLING_XCOMPLETION_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Turns a completion string returned by cling into what is shown to the user.
+     *
+     * The result type ([#int#]) is removed and the placeholders of the parameters
+     * (<#const char *name#>) are replaced by their types (const char *). The string is
+     * scanned only once.
+     *
+     * @param completion The completion string, e.g. "[#int#]foo(<#int x#>, <#double y#>)".
+     * @return std::string The formatted completion, e.g. "foo(int, double)".
+     */
+    std::string format_completion(std::string_view completion);
+
+    /**
+     * @brief Orders completions: first the names used in the cell being edited, then the
+     * names declared by the user in previous cells and finally everything else (the
+     * standard library, included headers...). Alphabetical order is kept within each
+     * group.
+     *
+     * @param completions Formatted completions, sorted alphabetically.
+     * @param code The cell being edited.
+     * @param is_user_declaration Tells whether a name has been declared in a cell.
+     * @param max_count Maximum number of completions returned.
+     * @return std::vector<std::string> The ranked completions.
+     */
+    std::vector<std::string> rank_completions(std::vector<std::string> completions,
+        std::string_view code, const std::function<bool(std::string_view)>& is_user_declaration,
+        std::size_t max_count);
+
+    /**
+     * @brief Keeps the completions of the last request, so that the following keystrokes
+     * narrowing the same word are answered without asking cling again.
+     *
+     * An entry is only valid for the same context (the cell without the word being
+     * completed) and the same declaration generation, which changes every time a cell
+     * declares something.
+     *
+     */
+    class completion_cache
+    {
+        public:
+
+        /**
+         * @brief Looks for the completions of prefix in the cache.
+         *
+         * @param generation Current declaration generation.
+         * @param context The cell without the word being completed.
+         * @param prefix The part of the word before the cursor.
+         * @param completions Set to the completions found, sorted alphabetically.
+         * @return true if the cache could answer.
+         */
+        bool lookup(std::size_t generation, std::string_view context, std::string_view prefix,
+            std::vector<std::string>& completions) const;
+
+        /**
+         * @brief Stores the completions cling has returned for prefix.
+         *
+         */
+        void store(std::size_t generation, std::string_view context, std::string_view prefix,
+            std::vector<std::string> completions);
+
+        private:
+
+        bool m_valid = false;
+        std::size_t m_generation = 0;
+        std::string m_context;
+        std::string m_prefix;
+        // Sorted, so that the completions of a longer prefix are a contiguous range.
+        std::vector<std::string> m_completions;
+    };
+}
+
+#endif // ALS_XEUS_CLING_XCOMPLETION_HPP
@@ -4,6 +4,18 @@
 #include "nlohmann/json.hpp"
 namespace nl = nlohmann;
 
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include "xinterpreter.hpp"
 #include <als-basic-utilities/ToString.hpp>
 
@@ -11,21 +23,303 @@ extern als::xeus_cling::interpreter* xci;
 
 namespace als::xeus_cling
 {
-    // Mime representation latex and plain.
+    namespace detail
+    {
+        // Containers, other than strings, whose elements can be summarized.
+        template<class T, class = void>
+        struct is_summarizable : std::false_type {};
+
+        template<class T>
+        struct is_summarizable<T, std::void_t<
+            decltype(std::size(std::declval<const T&>())),
+            decltype(std::begin(std::declval<const T&>())),
+            decltype(std::end(std::declval<const T&>()))>> :
+            std::bool_constant<!std::is_convertible_v<const T&, std::string_view>> {};
+
+        // Number of elements of an object, counting those of the nested containers
+        // instead of the containers themselves. The count stops as soon as it exceeds
+        // limit, so that big containers are not walked.
+        template<class T>
+        std::size_t count_elements(const T& object, std::size_t limit)
+        {
+            if constexpr (is_summarizable<T>::value)
+            {
+                using element_type = std::decay_t<decltype(*std::begin(object))>;
+                const std::size_t size = std::size(object);
+                if constexpr (!is_summarizable<element_type>::value)
+                {
+                    return size;
+                }
+                else
+                {
+                    if (size > limit)
+                    {
+                        return size;
+                    }
+                    std::size_t count = 0;
+                    for (const element_type& element : object)
+                    {
+                        count += count_elements(element, limit - count);
+                        if (count > limit)
+                        {
+                            break;
+                        }
+                    }
+                    return count;
+                }
+            }
+            else
+            {
+                static_cast<void>(object);
+                static_cast<void>(limit);
+                return 1;
+            }
+        }
+
+        template<bool latex, class T, class... Args>
+        std::string summarize(const T& container, std::size_t budget, Args... args);
+
+        // Representation of an object, summarized if it is a container with too many
+        // elements. budget is the number of elements that can be formatted, nested
+        // containers included.
+        template<bool latex, class T, class... Args>
+        std::string format_object(const T& object, std::size_t budget, Args... args)
+        {
+            if constexpr (is_summarizable<T>::value)
+            {
+                if (std::size(object) > xci->display_budget.max_elements ||
+                    count_elements(object, budget) > budget)
+                {
+                    return summarize<latex>(object, budget, args...);
+                }
+            }
+            if constexpr (latex)
+            {
+                return als::utilities::to_latex(object, args...);
+            }
+            else
+            {
+                return als::utilities::to_plain(object, args...);
+            }
+        }
+
+        // Formats only the first and the last elements of a container. The elements
+        // in between are skipped without being visited when the container provides
+        // random access. The budget is shared among the elements shown.
+        template<bool latex, class T, class... Args>
+        std::string summarize(const T& container, std::size_t budget, Args... args)
+        {
+            const std::size_t size = std::size(container);
+            const std::size_t shown = std::min({size, xci->display_budget.max_elements,
+                std::max<std::size_t>(budget, 1)});
+            const std::size_t head = (shown + 1) / 2;
+            const std::size_t tail = shown - head;
+            const std::size_t element_budget = std::max<std::size_t>(
+                budget / std::max<std::size_t>(shown, 1), 1);
+
+            std::string res = latex ? "\\left[" : "[";
+            auto element = std::begin(container);
+            for (std::size_t i = 0; i < size; ++i, ++element)
+            {
+                if (i == head && shown < size)
+                {
+                    res += (i == 0) ? "" : ", ";
+                    res += latex ? "\\ldots" : "...";
+                    element = std::next(element, size - tail - head);
+                    i = size - tail;
+                    if (i == size)
+                    {
+                        break;
+                    }
+                }
+                if (i > 0)
+                {
+                    res += ", ";
+                }
+                res += format_object<latex>(*element, element_budget, args...);
+            }
+            res += latex ? "\\right]" : "]";
+            if constexpr (!latex)
+            {
+                if (shown < size)
+                {
+                    res += " (" + std::to_string(size) + " elements)";
+                }
+            }
+            return res;
+        }
+
+        // Cuts a plain representation longer than the display budget, at a character
+        // boundary.
+        inline std::string truncate(std::string text)
+        {
+            const std::size_t max_bytes = xci->display_budget.max_bytes;
+            if (text.size() <= max_bytes)
+            {
+                return text;
+            }
+
+            std::size_t end = max_bytes;
+            while (end > 0 && (static_cast<unsigned char>(text[end]) & 0xC0) == 0x80)
+            {
+                --end;
+            }
+            const std::size_t dropped = text.size() - end;
+            text.resize(end);
+            return text + "\n... (" + std::to_string(dropped) + " more bytes)";
+        }
+
+        // Objects displayed through a std::shared_ptr, which are displayed as the object
+        // they point to.
+        template<class T>
+        struct is_shared_ptr : std::false_type {};
+
+        template<class T>
+        struct is_shared_ptr<std::shared_ptr<T>> : std::bool_constant<!std::is_array_v<T>> {};
+
+        // If the object has been summarized, keeps it so that the frontend can request
+        // the elements that have not been formatted, and tells it how. The object is
+        // kept through owner if it has been displayed through a std::shared_ptr, and
+        // through the storage of the value if it is the result of the cell; otherwise,
+        // it is only copied if display_budget.copy_summarized is set.
+        template<bool latex, class T, class... Args>
+        void add_pager(nl::json& res, const T& object, std::shared_ptr<const T> owner,
+            Args... args)
+        {
+            if constexpr (is_summarizable<T>::value)
+            {
+                const std::size_t size = std::size(object);
+                const std::size_t max_elements = xci->display_budget.max_elements;
+                if (size <= max_elements)
+                {
+                    return;
+                }
+
+                if (owner == nullptr && xci->displayed_result.get() == &object)
+                {
+                    owner = std::shared_ptr<const T>(xci->displayed_result, &object);
+                }
+                if constexpr (std::is_copy_constructible_v<T>)
+                {
+                    if (owner == nullptr && xci->display_budget.copy_summarized)
+                    {
+                        owner = std::make_shared<const T>(object);
+                    }
+                }
+                if (owner == nullptr)
+                {
+                    return;
+                }
+
+                const std::size_t id = xci->register_pager(size,
+                    [owner, args...](std::size_t start, std::size_t count)
+                    {
+                        // The elements of a page share the budget of a summary.
+                        const std::size_t budget = std::max<std::size_t>(
+                            xci->display_budget.max_elements / std::max<std::size_t>(count, 1), 1);
+                        std::vector<std::string> elements;
+                        auto element = std::next(std::begin(*owner), start);
+                        for (std::size_t i = 0; i < count; ++i, ++element)
+                        {
+                            elements.push_back(format_object<latex>(*element, budget, args...));
+                        }
+                        return elements;
+                    });
+
+                nl::json pager;
+                pager["pager_id"] = id;
+                pager["size"] = size;
+                pager["head"] = (max_elements + 1) / 2;
+                pager["tail"] = max_elements - (max_elements + 1) / 2;
+                res["application/vnd.als-xeus-cling.pager+json"] = std::move(pager);
+            }
+        }
+
+        // Mime representations of an object, kept through owner if it is not null.
+        // Arithmetic values are never summarized nor truncated, which lets the kernel
+        // itself use these functions.
+        template<class T, class... Args>
+        nl::json plain_representation(const T& object, std::shared_ptr<const T> owner,
+            Args... args)
+        {
+            nl::json res;
+            if constexpr (std::is_arithmetic_v<T>)
+            {
+                res["text/plain"] = als::utilities::to_plain(object, args...);
+            }
+            else
+            {
+                res["text/plain"] = truncate(format_object<false>(object,
+                    xci->display_budget.max_elements, args...));
+                add_pager<false>(res, object, std::move(owner), args...);
+            }
+            return res;
+        }
+
+        template<class T, class... Args>
+        nl::json latex_representation(const T& object, std::shared_ptr<const T> owner,
+            Args... args)
+        {
+            nl::json res;
+            if constexpr (std::is_arithmetic_v<T>)
+            {
+                res["text/latex"] = "$" + als::utilities::to_latex(object, args...) + "$";
+            }
+            else
+            {
+                std::string latex = format_object<true>(object,
+                    xci->display_budget.max_elements, args...);
+                // The browser would freeze rendering it.
+                if (latex.size() > xci->display_budget.max_bytes)
+                {
+                    return plain_representation(object, std::move(owner), args...);
+                }
+                res["text/latex"] = "$" + latex + "$";
+                add_pager<true>(res, object, std::move(owner), args...);
+            }
+            return res;
+        }
+    }
+
+    // Mime representation latex and plain. An object displayed through a
+    // std::shared_ptr is represented as the object it points to, and shared with its
+    // pager if it is summarized instead of being copied.
     template<class T, class... Args>
     nl::json inline mime_representation_plain(const T& object, Args... args)
     {
-        nl::json res;
-        res["text/plain"] = als::utilities::to_plain(object, args...);
-        return res;
+        if constexpr (detail::is_shared_ptr<T>::value)
+        {
+            if (object == nullptr)
+            {
+                return {{"text/plain", "nullptr"}};
+            }
+            using element_type = std::remove_const_t<typename T::element_type>;
+            return detail::plain_representation<element_type>(*object,
+                std::shared_ptr<const element_type>(object), args...);
+        }
+        else
+        {
+            return detail::plain_representation<T>(object, nullptr, args...);
+        }
     }
 
     template<class T, class... Args>
     nl::json inline mime_representation_latex(const T& object, Args... args)
     {
-        nl::json res;
-        res["text/latex"] = "$" + als::utilities::to_latex(object, args...) + "$";
-        return res;
+        if constexpr (detail::is_shared_ptr<T>::value)
+        {
+            if (object == nullptr)
+            {
+                return {{"text/latex", "$\\mathrm{nullptr}$"}};
+            }
+            using element_type = std::remove_const_t<typename T::element_type>;
+            return detail::latex_representation<element_type>(*object,
+                std::shared_ptr<const element_type>(object), args...);
+        }
+        else
+        {
+            return detail::latex_representation<T>(object, nullptr, args...);
+        }
     }
 
     template<class T, class... Args>
@@ -42,23 +336,152 @@ namespace als::xeus_cling
     void inline display(const T& object,
         const als::utilities::RepresentationType rt, Args... args)
     {
-        xci->display_data(mime_representation(object, rt, args...),
-            nl::json::object(), nl::json::object());
+        xci->publish_display(mime_representation(object, rt, args...));
     }
 
     template<class T, class... Args>
     void inline display_plain(const T& object, Args... args)
     {
-        xci->display_data(mime_representation_plain(object, args...),
-            nl::json::object(), nl::json::object());
+        xci->publish_display(mime_representation_plain(object, args...));
     }
 
     template<class T, class... Args>
     void inline display_latex(const T& object, Args... args)
     {
-        xci->display_data(mime_representation_latex(object, args...),
-            nl::json::object(), nl::json::object());
+        xci->publish_display(mime_representation_latex(object, args...));
     }
+
+    /**
+     * @brief Name of the type of the elements of an array, as in numpy.
+     * 
+     */
+    template<class T>
+    std::string array_dtype()
+    {
+        static_assert(std::is_arithmetic_v<T>,
+            "Only arrays of arithmetic types can be displayed as binary buffers.");
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            return "bool";
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            return "float" + std::to_string(8 * sizeof(T));
+        }
+        else if constexpr (std::is_signed_v<T>)
+        {
+            return "int" + std::to_string(8 * sizeof(T));
+        }
+        else
+        {
+            return "uint" + std::to_string(8 * sizeof(T));
+        }
+    }
+
+    /**
+     * @brief Displays a numeric array by sending its memory as a binary buffer instead
+     * of formatting it (see interpreter::publish_array). Meant for arrays too big to be
+     * displayed as text.
+     * 
+     * @param data The contiguous elements of the array, in row-major order.
+     * @param shape Dimensions of the array.
+     * @param compress If true, the buffer is compressed with zlib.
+     */
+    template<class T>
+    void display_array(const T* data, const std::vector<std::size_t>& shape,
+        bool compress = false)
+    {
+        const std::size_t count = std::accumulate(shape.begin(), shape.end(),
+            std::size_t{1}, std::multiplies<std::size_t>());
+        xci->publish_array(data, count * sizeof(T), array_dtype<T>(), shape, compress);
+    }
+
+    template<class T>
+    void display_array(const std::vector<T>& vector, bool compress = false)
+    {
+        display_array(vector.data(), {vector.size()}, compress);
+    }
+
+    /**
+     * @brief While alive, consecutive displays of plain or latex representations are
+     * merged into as few messages as possible, which makes displaying many objects in a
+     * loop much faster. Plain representations are published as lines of a single text
+     * and latex ones as rows of a single array.
+     * 
+     */
+    class display_batch
+    {
+        public:
+
+        display_batch()
+        {
+            xci->begin_display_batch();
+        }
+
+        display_batch(const display_batch&) = delete;
+        display_batch& operator=(const display_batch&) = delete;
+
+        ~display_batch()
+        {
+            xci->end_display_batch();
+        }
+    };
+
+    /**
+     * @brief A display whose contents can be replaced, e.g. to show the progress of a
+     * loop. The first update creates the display and the next ones replace it, instead
+     * of appending new outputs to the cell.
+     * 
+     */
+    class display_handle
+    {
+        public:
+
+        display_handle(): m_id{xci->new_display_id()}, m_displayed{false}
+        {
+        }
+
+        template<class T, class... Args>
+        void update(const T& object, const als::utilities::RepresentationType rt,
+            Args... args)
+        {
+            publish(mime_representation(object, rt, args...));
+        }
+
+        template<class T, class... Args>
+        void update_plain(const T& object, Args... args)
+        {
+            publish(mime_representation_plain(object, args...));
+        }
+
+        template<class T, class... Args>
+        void update_latex(const T& object, Args... args)
+        {
+            publish(mime_representation_latex(object, args...));
+        }
+
+        private:
+
+        void publish(nl::json data)
+        {
+            nl::json transient;
+            transient["display_id"] = m_id;
+            if (m_displayed)
+            {
+                xci->publish_display_update(std::move(data), nl::json::object(),
+                    std::move(transient));
+            }
+            else
+            {
+                xci->publish_display(std::move(data), nl::json::object(),
+                    std::move(transient));
+                m_displayed = true;
+            }
+        }
+
+        std::string m_id;
+        bool m_displayed;
+    };
 }
 
 #endif // ALS_XEUS_CLING_XDISPLAY_HPP
\ No newline at end of file
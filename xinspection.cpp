@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/DeclCXX.h>
+#include <clang/AST/PrettyPrinter.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/Lexer.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "xinspection.hpp"
+
+namespace
+{
+    bool is_identifier_char(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_';
+    }
+
+    template<class Map>
+    std::vector<const clang::NamedDecl*> equal_range(const Map& map, const std::string& key)
+    {
+        std::vector<const clang::NamedDecl*> res;
+        auto range = map.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            res.push_back(it->second);
+        }
+        return res;
+    }
+
+    template<class Map>
+    void erase_value(Map& map, const std::string& key, const clang::NamedDecl* value)
+    {
+        auto range = map.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == value)
+            {
+                map.erase(it);
+                return;
+            }
+        }
+    }
+
+    // Calls function on declaration and, if it is a namespace or a class definition,
+    // on its members.
+    template<class Function>
+    void for_each_indexed(const clang::Decl* declaration, const Function& function)
+    {
+        if (declaration == nullptr || declaration->isImplicit())
+        {
+            return;
+        }
+
+        function(declaration);
+
+        if (const clang::NamespaceDecl* space = llvm::dyn_cast<clang::NamespaceDecl>(declaration))
+        {
+            for (const clang::Decl* member : space->decls())
+            {
+                for_each_indexed(member, function);
+            }
+        }
+        else if (const clang::CXXRecordDecl* record = llvm::dyn_cast<clang::CXXRecordDecl>(declaration))
+        {
+            if (record->isThisDeclarationADefinition())
+            {
+                for (const clang::Decl* member : record->decls())
+                {
+                    for_each_indexed(member, function);
+                }
+            }
+        }
+    }
+}
+
+namespace als::xeus_cling
+{
+    void symbol_index::add(const clang::Decl* declaration)
+    {
+        for_each_indexed(declaration, [this](const clang::Decl* indexed)
+            {
+                const clang::NamedDecl* named = llvm::dyn_cast<clang::NamedDecl>(indexed);
+                if (named != nullptr && named->getIdentifier() != nullptr)
+                {
+                    m_qualified.emplace(named->getQualifiedNameAsString(), named);
+                    m_unqualified.emplace(named->getNameAsString(), named);
+                }
+            });
+    }
+
+    void symbol_index::remove(const clang::Decl* declaration)
+    {
+        for_each_indexed(declaration, [this](const clang::Decl* indexed)
+            {
+                const clang::NamedDecl* named = llvm::dyn_cast<clang::NamedDecl>(indexed);
+                if (named != nullptr && named->getIdentifier() != nullptr)
+                {
+                    erase_value(m_qualified, named->getQualifiedNameAsString(), named);
+                    erase_value(m_unqualified, named->getNameAsString(), named);
+                }
+            });
+    }
+
+    std::vector<const clang::NamedDecl*> symbol_index::find(const std::string& name) const
+    {
+        std::vector<const clang::NamedDecl*> res = equal_range(m_qualified, name);
+        if (res.empty() && name.find("::") == std::string::npos)
+        {
+            res = equal_range(m_unqualified, name);
+        }
+        return res;
+    }
+
+    std::size_t symbol_index::size() const
+    {
+        return m_qualified.size();
+    }
+
+    std::string identifier_at(std::string_view code, std::size_t cursor_pos)
+    {
+        std::size_t start = std::min(cursor_pos, code.size());
+        while (start > 0 && (is_identifier_char(code[start - 1]) || code[start - 1] == ':'))
+        {
+            --start;
+        }
+        std::size_t end = std::min(cursor_pos, code.size());
+        while (end < code.size() && is_identifier_char(code[end]))
+        {
+            ++end;
+        }
+
+        std::string_view res = code.substr(start, end - start);
+        while (!res.empty() && res.front() == ':')
+        {
+            res.remove_prefix(1);
+        }
+        while (!res.empty() && res.back() == ':')
+        {
+            res.remove_suffix(1);
+        }
+        return std::string(res);
+    }
+
+    std::string describe_declaration(const clang::NamedDecl* declaration, int detail_level)
+    {
+        const clang::ASTContext& context = declaration->getASTContext();
+        const clang::SourceManager& source_manager = context.getSourceManager();
+
+        // The declaration as it would be written, without its body.
+        std::string signature;
+        llvm::raw_string_ostream signature_stream(signature);
+        clang::PrintingPolicy policy(context.getPrintingPolicy());
+        policy.TerseOutput = true;
+        policy.PolishForDeclaration = true;
+        declaration->print(signature_stream, policy);
+        signature_stream.str();
+
+        std::string res = signature + "\n";
+
+        if (const clang::ValueDecl* value = llvm::dyn_cast<clang::ValueDecl>(declaration))
+        {
+            res += "Type: " + value->getType().getAsString() + "\n";
+        }
+
+        clang::PresumedLoc location = source_manager.getPresumedLoc(
+            source_manager.getExpansionLoc(declaration->getLocation()));
+        if (location.isValid())
+        {
+            res += "Declared in: " + std::string(location.getFilename()) + ":" +
+                std::to_string(location.getLine()) + "\n";
+        }
+
+        if (const clang::RawComment* comment = context.getRawCommentForDeclNoCache(declaration))
+        {
+            res += "\n" + comment->getRawText(source_manager).str() + "\n";
+        }
+
+        if (detail_level >= 1)
+        {
+            llvm::StringRef source = clang::Lexer::getSourceText(
+                clang::CharSourceRange::getTokenRange(declaration->getSourceRange()),
+                source_manager, context.getLangOpts());
+            if (!source.empty())
+            {
+                res += "\nSource:\n" + source.str() + "\n";
+            }
+        }
+
+        return res;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef ALS_XEUS_CLING_XINSPECTION_HPP
+#define ALS_XEUS_CLING_XINSPECTION_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace clang
+{
+    class Decl;
+    class NamedDecl;
+}
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Index of the declarations known by the interpreter, by name.
+     *
+     * It is built incrementally from the declarations of every committed transaction
+     * (including those coming from headers), descending into namespaces and classes,
+     * so that inspection requests do not have to walk the AST.
+     *
+     */
+    class symbol_index
+    {
+        public:
+
+        /**
+         * @brief Adds a declaration and, if it is a namespace or a class definition,
+         * its members.
+         *
+         */
+        void add(const clang::Decl* declaration);
+
+        /**
+         * @brief Removes a declaration added before and its members, e.g. because the
+         * transaction declaring it has been unloaded.
+         *
+         */
+        void remove(const clang::Decl* declaration);
+
+        /**
+         * @brief Returns the declarations whose qualified name is name or, if there is
+         * none, whose unqualified name is name.
+         *
+         * @param name Name as written by the user, e.g. "std::vector" or "vector".
+         * @return std::vector<const clang::NamedDecl*> The declarations found.
+         */
+        std::vector<const clang::NamedDecl*> find(const std::string& name) const;
+
+        /**
+         * @brief Number of declarations in the index.
+         *
+         */
+        std::size_t size() const;
+
+        private:
+
+        std::unordered_multimap<std::string, const clang::NamedDecl*> m_qualified;
+        std::unordered_multimap<std::string, const clang::NamedDecl*> m_unqualified;
+    };
+
+    /**
+     * @brief Returns the (possibly qualified) identifier under the cursor, e.g.
+     * "std::vector" for "std::vec|tor<int> v;".
+     *
+     */
+    std::string identifier_at(std::string_view code, std::size_t cursor_pos);
+
+    /**
+     * @brief Describes a declaration for an inspection reply: its signature, its type,
+     * where it is declared and its documentation comment.
+     *
+     * @param declaration The declaration.
+     * @param detail_level If it is 1 or more, the source code is also included.
+     * @return std::string Plain text description.
+     */
+    std::string describe_declaration(const clang::NamedDecl* declaration, int detail_level);
+}
+
+#endif // ALS_XEUS_CLING_XINSPECTION_HPP
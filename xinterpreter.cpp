@@ -1,307 +1,2234 @@
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
 
 #include "nlohmann/json.hpp"
 
+#include "xeus/xcomm.hpp"
+#include "xeus/xguid.hpp"
 #include "xeus/xinput.hpp"
 #include "xeus/xhelper.hpp"
 
 #include "xinterpreter.hpp"
+#include "xcapture.hpp"
+#include "xcompletion.hpp"
+#include "xdisplay.hpp"
+#include "xinspection.hpp"
+#include "xinterrupt.hpp"
+#include "xmagics.hpp"
 #include "xparser.hpp"
+#include "xstream.hpp"
+#include "xtiming.hpp"
 #include <cling/Interpreter/Interpreter.h>
 #include <cling/Interpreter/Value.h>
 #include <cling/Interpreter/Exception.h>
+#include <cling/Interpreter/InterpreterCallbacks.h>
+#include <cling/Interpreter/LookupHelper.h>
+#include <cling/Interpreter/Transaction.h>
 #include <cling/MetaProcessor/InputValidator.h>
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/GlobalDecl.h>
 #include <clang/AST/Type.h>
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Sema/SemaDiagnostic.h>
+#include <llvm/Support/Casting.h>
 
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
-#include <regex>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <zlib.h>
 
 namespace nl = nlohmann;
 
+namespace
+{
+    // Coalesced displays are published once they reach this size.
+    constexpr std::size_t max_batch_bytes = 1024 * 1024;
+
+    // Period at which the shell thread sends what a running cell publishes.
+    constexpr std::chrono::milliseconds publication_interval{10};
+
+    // Number of cells whose parent header is kept for the late messages of their
+    // threads.
+    constexpr std::size_t max_parented_cells = 1024;
+
+    // Maximum number of compiled cells kept to be run again.
+    constexpr std::size_t max_compiled_cells = 1024;
+
+    // Target of the comms through which arrays are sent as binary buffers.
+    const std::string array_comm_target = "als.xeus_cling.array";
+    // Target of the comms through which the frontend requests the elements of the
+    // summarized objects.
+    const std::string pager_comm_target = "als.xeus_cling.pager";
+
+    // Compresses a buffer with zlib. Returns an empty buffer if compressing does not
+    // make it smaller.
+    xeus::binary_buffer compress_buffer(const char* data, std::size_t size)
+    {
+        uLongf compressed_size = compressBound(size);
+        xeus::binary_buffer compressed(compressed_size);
+        // Arrays are displayed interactively, so speed matters more than size.
+        if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size,
+            reinterpret_cast<const Bytef*>(data), size, Z_BEST_SPEED) != Z_OK ||
+            compressed_size >= size)
+        {
+            return {};
+        }
+        compressed.resize(compressed_size);
+        return compressed;
+    }
+
+    // Maximum number of declarations (e.g. overloads) described by an inspection.
+    constexpr std::size_t max_inspected_declarations = 10;
+
+    // Looks for a declaration by name through clang's lookup: first as a type or a
+    // namespace and then as a function or a data member of its scope.
+    const clang::NamedDecl* lookup_declaration(const cling::Interpreter& interpreter,
+        const std::string& name)
+    {
+        const cling::LookupHelper& lookup = interpreter.getLookupHelper();
+        if (const clang::Decl* scope = lookup.findScope(name, cling::LookupHelper::NoDiagnostics))
+        {
+            if (const clang::NamedDecl* named = llvm::dyn_cast<clang::NamedDecl>(scope))
+            {
+                return named;
+            }
+        }
+
+        const std::size_t separator = name.rfind("::");
+        const std::string member = (separator == std::string::npos) ?
+            name : name.substr(separator + 2);
+        const clang::Decl* scope = (separator == std::string::npos) ?
+            interpreter.getCI()->getASTContext().getTranslationUnitDecl() :
+            lookup.findScope(name.substr(0, separator), cling::LookupHelper::NoDiagnostics);
+        if (scope == nullptr)
+        {
+            return nullptr;
+        }
+        if (const clang::FunctionDecl* function = lookup.findAnyFunction(scope, member,
+            cling::LookupHelper::NoDiagnostics))
+        {
+            return function;
+        }
+        return lookup.findDataMember(scope, member, cling::LookupHelper::NoDiagnostics);
+    }
+
+    // Computes the representation of the builtin arithmetic values directly in the
+    // kernel, with the same functions a display thunk would call, so the most common
+    // outputs never go through the JIT. Returns false for any other type.
+    bool builtin_mime_representation(cling::Value& value,
+        als::utilities::RepresentationType representation, nl::json& result)
+    {
+        using als::xeus_cling::mime_representation;
+
+        const clang::QualType type = value.getType().getNonReferenceType().getCanonicalType();
+        const clang::BuiltinType* builtin = type->getAs<clang::BuiltinType>();
+        if (builtin == nullptr)
+        {
+            return false;
+        }
+
+        // cling::Value stores the integers in a long long or an unsigned long long,
+        // depending on their signedness, and the floating point numbers with their own
+        // type.
+        switch (builtin->getKind())
+        {
+            case clang::BuiltinType::Bool:
+                result = mime_representation(static_cast<bool>(value.getULL()), representation);
+                return true;
+            case clang::BuiltinType::Char_S:
+                result = mime_representation(static_cast<char>(value.getLL()), representation);
+                return true;
+            case clang::BuiltinType::Char_U:
+                result = mime_representation(static_cast<char>(value.getULL()), representation);
+                return true;
+            case clang::BuiltinType::SChar:
+                result = mime_representation(static_cast<signed char>(value.getLL()), representation);
+                return true;
+            case clang::BuiltinType::UChar:
+                result = mime_representation(static_cast<unsigned char>(value.getULL()), representation);
+                return true;
+            case clang::BuiltinType::Short:
+                result = mime_representation(static_cast<short>(value.getLL()), representation);
+                return true;
+            case clang::BuiltinType::UShort:
+                result = mime_representation(static_cast<unsigned short>(value.getULL()), representation);
+                return true;
+            case clang::BuiltinType::Int:
+                result = mime_representation(static_cast<int>(value.getLL()), representation);
+                return true;
+            case clang::BuiltinType::UInt:
+                result = mime_representation(static_cast<unsigned int>(value.getULL()), representation);
+                return true;
+            case clang::BuiltinType::Long:
+                result = mime_representation(static_cast<long>(value.getLL()), representation);
+                return true;
+            case clang::BuiltinType::ULong:
+                result = mime_representation(static_cast<unsigned long>(value.getULL()), representation);
+                return true;
+            case clang::BuiltinType::LongLong:
+                result = mime_representation(value.getLL(), representation);
+                return true;
+            case clang::BuiltinType::ULongLong:
+                result = mime_representation(value.getULL(), representation);
+                return true;
+            case clang::BuiltinType::Float:
+                result = mime_representation(value.getFloat(), representation);
+                return true;
+            case clang::BuiltinType::Double:
+                result = mime_representation(value.getDouble(), representation);
+                return true;
+            case clang::BuiltinType::LongDouble:
+                result = mime_representation(value.getLongDouble(), representation);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Address of the object held by a cling::Value, to be passed to a display thunk.
+    // Builtin and enumeration values are stored inside cling::Value, in a long long
+    // whose address is also the address of any narrower integer on little endian
+    // targets; cling::Value points to objects of any other type.
+    void* value_address(cling::Value& value)
+    {
+        const clang::QualType type = value.getType().getNonReferenceType().getCanonicalType();
+        if (type->isEnumeralType() || type->isBuiltinType())
+        {
+            return type->isSignedIntegerOrEnumerationType() ?
+                static_cast<void*>(&value.getLL()) : static_cast<void*>(&value.getULL());
+        }
+        return value.getPtr();
+    }
+
+    // The input given to cling for the code of a cell: if its last line does not start
+    // with "#", we add a semicolon at the end.
+    std::string cell_input(const std::string& code)
+    {
+        return (code[code.find_last_of("\n") + 1] != '#') ? code + ";" : code;
+    }
+
+    bool has_preprocessor_directive(const std::string& code)
+    {
+        std::istringstream lines(code);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            const std::size_t start = line.find_first_not_of(" \t");
+            if (start != std::string::npos && line[start] == '#')
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether clang reports a diagnostic when a declaration conflicts with a previous
+    // one.
+    bool is_redefinition(unsigned id)
+    {
+        return id == clang::diag::err_redefinition ||
+            id == clang::diag::err_redefinition_different_kind ||
+            id == clang::diag::err_redefinition_different_type ||
+            id == clang::diag::err_redefinition_different_typedef ||
+            id == clang::diag::err_redefinition_of_enumerator ||
+            id == clang::diag::err_ovl_diff_return_type;
+    }
+
+    // Holds back the errors (and their notes) reported through engine while it is
+    // alive, and reports them when it is destroyed, unless they have been discarded.
+    // Warnings are reported right away.
+    class held_errors : public clang::DiagnosticConsumer
+    {
+        public:
+
+        explicit held_errors(clang::DiagnosticsEngine& engine):
+            m_engine{engine},
+            m_client{engine.getClient()},
+            m_owner{engine.takeClient()}
+        {
+            m_engine.setClient(this, false);
+        }
+
+        held_errors(const held_errors&) = delete;
+        held_errors& operator=(const held_errors&) = delete;
+
+        ~held_errors() override
+        {
+            const bool owned = m_owner != nullptr;
+            m_owner.release();
+            m_engine.setClient(m_client, owned);
+            for (const clang::StoredDiagnostic& diagnostic : m_held)
+            {
+                m_engine.Report(diagnostic);
+            }
+        }
+
+        void BeginSourceFile(const clang::LangOptions& options,
+            const clang::Preprocessor* preprocessor) override
+        {
+            m_client->BeginSourceFile(options, preprocessor);
+        }
+
+        void EndSourceFile() override
+        {
+            m_client->EndSourceFile();
+        }
+
+        void HandleDiagnostic(clang::DiagnosticsEngine::Level level,
+            const clang::Diagnostic& info) override
+        {
+            clang::DiagnosticConsumer::HandleDiagnostic(level, info);
+            // Notes belong to the diagnostic before them.
+            if (level >= clang::DiagnosticsEngine::Error ||
+                (level == clang::DiagnosticsEngine::Note && m_holding))
+            {
+                if (level >= clang::DiagnosticsEngine::Error)
+                {
+                    m_in_redefinition = is_redefinition(info.getID());
+                    m_redefinition = m_redefinition || m_in_redefinition;
+                }
+                else if (m_in_redefinition)
+                {
+                    // The note of a redefinition points to the previous definition.
+                    m_previous_definitions.push_back(info.getLocation());
+                }
+                m_holding = true;
+                m_held.emplace_back(level, info);
+            }
+            else
+            {
+                m_holding = false;
+                m_client->HandleDiagnostic(level, info);
+            }
+        }
+
+        // Whether one of the errors held is a redefinition.
+        bool redefinition() const
+        {
+            return m_redefinition;
+        }
+
+        // Where the notes of the redefinitions held point, i.e. the previous definitions.
+        const std::vector<clang::SourceLocation>& previous_definitions() const
+        {
+            return m_previous_definitions;
+        }
+
+        void discard()
+        {
+            m_held.clear();
+        }
+
+        private:
+
+        clang::DiagnosticsEngine& m_engine;
+        clang::DiagnosticConsumer* m_client;
+        std::unique_ptr<clang::DiagnosticConsumer> m_owner;
+        std::vector<clang::StoredDiagnostic> m_held;
+        std::vector<clang::SourceLocation> m_previous_definitions;
+        bool m_holding = false;
+        bool m_redefinition = false;
+        bool m_in_redefinition = false;
+    };
+
+    // Calls function on the top-level declarations of transaction and of the
+    // transactions nested in it.
+    template<class Function>
+    void for_each_top_level_declaration(const cling::Transaction& transaction,
+        const Function& function)
+    {
+        for (auto call = transaction.decls_begin(); call != transaction.decls_end(); ++call)
+        {
+            if (call->m_Call != cling::Transaction::kCCIHandleTopLevelDecl)
+            {
+                continue;
+            }
+            for (const clang::Decl* declaration : call->m_DGR)
+            {
+                function(declaration);
+            }
+        }
+        if (transaction.hasNestedTransactions())
+        {
+            for (auto nested = transaction.nested_begin(); nested != transaction.nested_end();
+                ++nested)
+            {
+                for_each_top_level_declaration(**nested, function);
+            }
+        }
+    }
+
+    // Whether every location is in a file where one of the declarations is: the input
+    // of the cell which has compiled them, or a header it has included.
+    bool in_files_of(const clang::SourceManager& sources,
+        const std::vector<clang::SourceLocation>& locations,
+        const std::vector<const clang::Decl*>& declarations)
+    {
+        std::set<clang::FileID> files;
+        for (const clang::Decl* declaration : declarations)
+        {
+            if (declaration->getLocation().isValid())
+            {
+                files.insert(sources.getFileID(
+                    sources.getExpansionLoc(declaration->getLocation())));
+            }
+        }
+        return std::all_of(locations.begin(), locations.end(),
+            [&](const clang::SourceLocation& location)
+            {
+                return location.isValid() && files.count(sources.getFileID(
+                    sources.getExpansionLoc(location))) != 0;
+            });
+    }
+
+    // Sets the optimization level of the code compiled while it is alive, and restores
+    // the previous one when it is destroyed, even if the code throws. The level is only
+    // changed under the compilation lock, which is not held in between.
+    class optimization_level_guard
+    {
+        public:
+
+        optimization_level_guard(cling::Interpreter& interpreter, std::mutex& mutex,
+            int level):
+            m_interpreter{interpreter},
+            m_mutex{mutex}
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_previous_level = m_interpreter.getDefaultOptLevel();
+            m_interpreter.setDefaultOptLevel(level);
+        }
+
+        optimization_level_guard(const optimization_level_guard&) = delete;
+        optimization_level_guard& operator=(const optimization_level_guard&) = delete;
+
+        ~optimization_level_guard()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_interpreter.setDefaultOptLevel(m_previous_level);
+        }
+
+        private:
+
+        cling::Interpreter& m_interpreter;
+        std::mutex& m_mutex;
+        int m_previous_level = 0;
+    };
+
+    // Memory of the process resident in RAM, in bytes.
+    std::size_t resident_memory()
+    {
+        std::ifstream statm("/proc/self/statm");
+        std::size_t size = 0;
+        std::size_t resident = 0;
+        statm >> size >> resident;
+        return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    // Trace of the session, written when the environment variable
+    // ALS_XEUS_CLING_TRACE names a file. Returns nullptr otherwise.
+    als::xeus_cling::trace_writer* session_trace()
+    {
+        static const std::unique_ptr<als::xeus_cling::trace_writer> trace =
+            []() -> std::unique_ptr<als::xeus_cling::trace_writer>
+            {
+                const char* path = std::getenv("ALS_XEUS_CLING_TRACE");
+                if (path == nullptr || *path == '\0')
+                {
+                    return nullptr;
+                }
+                auto writer = std::make_unique<als::xeus_cling::trace_writer>(path);
+                if (!writer->is_open())
+                {
+                    std::clog << "Could not open the trace file " << path << std::endl;
+                    return nullptr;
+                }
+                return writer;
+            }();
+        return trace.get();
+    }
+
+    // Reads the files listed in a dependency file written by clang (-MD), in the syntax
+    // of make: "target: dependency dependency \", where spaces in the paths are escaped
+    // by a backslash and dollars are doubled. Returns false if it can not be read.
+    bool read_dependencies(const std::filesystem::path& path,
+        std::vector<std::string>& dependencies)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            return false;
+        }
+        const std::string text((std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>());
+        const std::size_t colon = text.find(": ");
+        if (colon == std::string::npos)
+        {
+            return false;
+        }
+
+        std::string dependency;
+        auto add_dependency = [&dependencies, &dependency]()
+            {
+                if (!dependency.empty())
+                {
+                    dependencies.push_back(std::move(dependency));
+                    dependency.clear();
+                }
+            };
+        for (std::size_t i = colon + 2; i < text.size(); ++i)
+        {
+            const char next = (i + 1 < text.size()) ? text[i + 1] : '\0';
+            if (text[i] == '\\' && (next == ' ' || next == '#'))
+            {
+                dependency += next;
+                ++i;
+            }
+            else if (text[i] == '$' && next == '$')
+            {
+                dependency += '$';
+                ++i;
+            }
+            else if (text[i] == '\\' && (next == '\n' || next == '\r'))
+            {
+                // A line continuation.
+                add_dependency();
+            }
+            else if (text[i] == ' ' || text[i] == '\t' || text[i] == '\n' || text[i] == '\r')
+            {
+                add_dependency();
+            }
+            else
+            {
+                dependency += text[i];
+            }
+        }
+        add_dependency();
+        return true;
+    }
+
+    // Returns the path of the precompiled prelude if it can be used, that is, if it
+    // exists, it has been built for the given language standard, which the prelude
+    // target of the Makefile writes next to it, and it is newer than every file it has
+    // been built from, which the Makefile lists in a dependency file next to it (the
+    // headers of the kernel as well as those of the standard library, xeus, nlohmann
+    // json, cling and als-basic-utilities). clang would stop with a fatal error on a
+    // stale one. Otherwise, returns an empty string and explains why in reason.
+    std::string usable_prelude_pch(const std::filesystem::path& pch,
+        const std::string& standard, std::string& reason)
+    {
+        std::error_code error;
+        const auto pch_time = std::filesystem::last_write_time(pch, error);
+        if (error)
+        {
+            reason = pch.string() + " not found";
+            return "";
+        }
+
+        const std::filesystem::path standard_file = pch.string() + ".std";
+        std::string pch_standard;
+        if (!(std::ifstream(standard_file) >> pch_standard))
+        {
+            reason = standard_file.string() + " not found";
+            return "";
+        }
+        if (pch_standard != standard)
+        {
+            reason = "it is built for " + pch_standard + ", not for " + standard;
+            return "";
+        }
+
+        const std::filesystem::path dependency_file = pch.string() + ".d";
+        std::vector<std::string> dependencies;
+        if (!read_dependencies(dependency_file, dependencies))
+        {
+            reason = dependency_file.string() + " not found";
+            return "";
+        }
+        for (const std::string& dependency : dependencies)
+        {
+            const auto dependency_time = std::filesystem::last_write_time(dependency, error);
+            if (error)
+            {
+                reason = pch.string() + " depends on " + dependency + ", which is missing";
+                return "";
+            }
+            if (dependency_time > pch_time)
+            {
+                reason = pch.string() + " is older than " + dependency;
+                return "";
+            }
+        }
+
+        return pch.string();
+    }
+
+    // Tells whether a declaration has been written in a cell, rather than in a header.
+    // cling names the buffers of the cells input_line_N.
+    bool is_cell_declaration(const clang::Decl* declaration)
+    {
+        const clang::SourceManager& source_manager =
+            declaration->getASTContext().getSourceManager();
+        clang::PresumedLoc location = source_manager.getPresumedLoc(
+            source_manager.getExpansionLoc(declaration->getLocation()));
+        return location.isValid() &&
+            std::string_view(location.getFilename()).substr(0, 11) == "input_line_";
+    }
+
+    // Arguments used to create the cling interpreter. The precompiled prelude is
+    // loaded only when it is up to date and it has been built for the same language
+    // standard and target CPU, since clang rejects it otherwise.
+    std::vector<std::string> make_interpreter_arguments(
+        const als::xeus_cling::kernel_options& options)
+    {
+        std::vector<std::string> arguments({"xeus-cling", "-std=" + options.standard});
+        for (const std::string& path : options.library_paths)
+        {
+            arguments.push_back("-L" + path);
+        }
+
+        std::string reason;
+        std::string pch;
+        if (options.prelude_pch.empty())
+        {
+            reason = "disabled";
+        }
+        else if (!options.target_cpu.empty())
+        {
+            reason = "the JIT targets " + options.target_cpu;
+        }
+        else
+        {
+            pch = usable_prelude_pch(options.prelude_pch, options.standard, reason);
+        }
+
+        if (!options.target_cpu.empty())
+        {
+            arguments.push_back("-march=" + options.target_cpu);
+        }
+        if (!pch.empty())
+        {
+            arguments.push_back("-include-pch");
+            arguments.push_back(pch);
+        }
+        else
+        {
+            std::clog << "als-xeus-cling-kernel: precompiled prelude not used ("
+                << reason << ")" << std::endl;
+        }
+
+        return arguments;
+    }
+
+    // cling expects the arguments as an array of C strings. The pointers are only
+    // valid while arguments is alive.
+    std::vector<const char*> to_argv(const std::vector<std::string>& arguments)
+    {
+        std::vector<const char*> argv;
+        for (const std::string& argument : arguments)
+        {
+            argv.push_back(argument.c_str());
+        }
+        return argv;
+    }
+}
+
 namespace als::xeus_cling
 {
-    interpreter::interpreter(): cling_interpreter{cling::Interpreter(2,
-            std::vector<char*>({"xeus-cling", "-std=c++17"}).data())},
-            cling_input_validator({cling::InputValidator()}),
-            display_preferencies{als::utilities::RepresentationType::PLAIN}
+    class interpreter::callbacks : public cling::InterpreterCallbacks
+    {
+        public:
+
+        callbacks(interpreter& owner):
+            cling::InterpreterCallbacks(&owner.cling_interpreter),
+            m_owner{owner}
+        {
+        }
+
+        void TransactionCommitted(const cling::Transaction& transaction) override
+        {
+            m_owner.transaction_committed(transaction);
+        }
+
+        private:
+
+        interpreter& m_owner;
+    };
+
+    interpreter::interpreter(const kernel_options& kernel_options):
+            options{kernel_options},
+            interpreter_arguments{make_interpreter_arguments(options)},
+            cling_interpreter{static_cast<int>(interpreter_arguments.size()),
+                to_argv(interpreter_arguments).data()},
+            display_preferencies{als::utilities::RepresentationType::PLAIN},
+            stream_limits{},
+            display_budget{},
+            max_completions{200}
     {
+        cling_interpreter.setCallbacks(std::make_unique<callbacks>(*this));
+
         // We add necessary includes.
-        cling_interpreter.AddIncludePath(ALS_CLANG_INCLUDE_PATH);
-        cling_interpreter.AddIncludePath(ALS_CLING_INCLUDE_PATH);
+        for (const std::string& path : options.include_paths)
+        {
+            cling_interpreter.AddIncludePath(path);
+        }
         cling_interpreter.AddIncludePath(std::filesystem::current_path().string());
 
+        // The optimization level is set here rather than with a -O argument, which would
+        // make clang reject the precompiled prelude.
+        if (options.optimization_level >= 0)
+        {
+            cling_interpreter.setDefaultOptLevel(options.optimization_level);
+        }
+
+        // We include the prelude (xinterpreter.hpp and xdisplay.hpp). If the precompiled
+        // prelude has been loaded, its include guards are already defined and this costs
+        // nothing. Otherwise, it is parsed from source.
+        const auto prelude_start = std::chrono::steady_clock::now();
+        cling_interpreter.process("#include <als-xeus-cling/xprelude.hpp>", nullptr, nullptr, false);
+
         // We expose the interpreter to cling as a pointer called xci.
-        cling_interpreter.process("#include <als-xeus-cling/xinterpreter.hpp>", nullptr, nullptr, false);
         cling_interpreter.process(
             "als::xeus_cling::interpreter* xci = (als::xeus_cling::interpreter*)" +
                 std::to_string(intptr_t(this)) + ";",
             nullptr, nullptr, false);
 
-        // We include display.hpp.
-        cling_interpreter.process("#include <als-xeus-cling/xdisplay.hpp>", nullptr, nullptr, false);
+        const bool pch_loaded = std::find(interpreter_arguments.begin(),
+            interpreter_arguments.end(), "-include-pch") != interpreter_arguments.end();
+        std::clog << "als-xeus-cling-kernel: prelude loaded in "
+            << std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - prelude_start).count()
+            << " ms (" << (pch_loaded ? "precompiled header" : "textual includes") << ")"
+            << std::endl;
+
+        // The macros are defined after the prelude, which is not affected by them, for
+        // the same reason.
+        for (const std::string& definition : options.definitions)
+        {
+            const std::size_t equal = definition.find('=');
+            cling_interpreter.process("#define " + ((equal == std::string::npos) ?
+                definition + " 1" : definition.substr(0, equal) + " " +
+                definition.substr(equal + 1)), nullptr, nullptr, false);
+        }
+
+        // Magics provided by the kernel.
+        magics.add("time", [this](const magic_command& command, int execution_counter)
+            {
+                // %time also executes the lines after it.
+                const std::string code = command.is_cell_magic ? command.body :
+                    command.arguments + "\n" + command.body;
+                return execute_cell(execution_counter, code, false, true,
+                    nl::json::object(), false, true);
+            });
+        magics.add("timeit", [this](const magic_command& command, int execution_counter)
+            {
+                return timeit_magic(command, execution_counter);
+            });
+        magics.add("optimize", [this](const magic_command& command, int execution_counter)
+            {
+                return optimize_magic(command, execution_counter);
+            });
+        magics.add("replay", [this](const magic_command& command, int execution_counter)
+            {
+                return replay_magic(command, execution_counter);
+            });
+        magics.add("unload", [this](const magic_command& command, int execution_counter)
+            {
+                return unload_magic(command, execution_counter);
+            });
+        magics.add("reset", [this](const magic_command& command, int execution_counter)
+            {
+                return unload_magic(command, execution_counter);
+            });
+        magics.add("memory", [this](const magic_command& command, int execution_counter)
+            {
+                return memory_magic(command, execution_counter);
+            });
+
+        // The timestamps of the trace, if any, start with the session.
+        session_trace();
 
         // We register the interpreter.
         xeus::register_interpreter(this);
     }
 
-    nl::json interpreter::execute_request_impl(int execution_counter,
-        const std::string& code, bool silent, bool store_history,
-        nl::json user_expressions, bool allow_stdin)
+    nl::json interpreter::execute_request_impl(int execution_counter,
+        const std::string& code, bool silent, bool store_history,
+        nl::json user_expressions, bool allow_stdin)
+    {
+        // Cells are executed on their own thread, which is the only one that can be
+        // interrupted. Meanwhile, this thread publishes what the cell publishes and
+        // delivers the interruptions that could not be delivered at once. What the
+        // previous cells still publish is told apart from what this one publishes.
+        drain_publications();
+        active_cell = ++started_cells;
+        cell_parents[active_cell] = parent_header();
+        if (active_cell > max_parented_cells)
+        {
+            cell_parents.erase(active_cell - max_parented_cells);
+        }
+        nl::json kernel_res;
+        // A cell that crashes the kernel is not replayed by the next one.
+        journal.begin_cell(code);
+        cell_worker.run([&]()
+            {
+                std::optional<magic_command> magic = parse_magic(code);
+                if (!magic)
+                {
+                    kernel_res = execute_cell(execution_counter, code, silent,
+                        store_history, user_expressions, allow_stdin, false);
+                    return;
+                }
+
+                const magic_registry::handler* handler = magics.find(magic->name);
+                if (handler == nullptr)
+                {
+                    kernel_res = error_reply("UsageError", std::string(
+                        magic->is_cell_magic ? "Cell magic `%%" : "Line magic `%") +
+                        magic->name + "` not found.");
+                    return;
+                }
+                try
+                {
+                    kernel_res = (*handler)(*magic, execution_counter);
+                }
+                catch (const std::exception& e)
+                {
+                    kernel_res = error_reply("Standard Exception", e.what());
+                }
+            },
+            [this]()
+            {
+                drain_publications();
+                retry_interrupt();
+            }, publication_interval);
+        journal.end_cell();
+        active_cell = 0;
+        return kernel_res;
+    }
+
+    nl::json interpreter::execute_cell(int execution_counter,
+        const std::string& code, bool silent, bool store_history,
+        nl::json user_expressions, bool allow_stdin, bool report_timing)
+    {
+        // 1. We create the return value. We also time every phase of the execution.
+        nl::json kernel_res;
+        cell_timing timing;
+        const cell_timing::clock::time_point cell_start = cell_timing::clock::now();
+        execution_start_time.reset();
+
+        // 2. We prepare cling objects for the cling interpreter. We hold the
+        // compilation lock until the cell has finished, so that the preloading of the
+        // kernel or a replay running in the background are finished first.
+        cling::Value output;
+        cling::Interpreter::CompilationResult compilation_result =
+            cling::Interpreter::kFailure;
+        std::lock_guard<std::mutex> compilation_lock(compilation_mutex);
+
+        // 3. We redirect std::cout and std::cerr outputs to streams that publish them
+        // while the cell is running. We also capture what is written directly into the
+        // file descriptors 1 and 2 (printf, native libraries, cling diagnostics...).
+        output_capture cell_output([this](const std::string& text)
+            {
+                publish_output("stdout", text);
+            },
+            [this](const std::string& text)
+            {
+                publish_output("stderr", text);
+            }, stream_limits);
+        cell_output.start();
+        const cell_timing::clock::time_point compilation_start = cell_timing::clock::now();
+        timing.add("prepare", cell_start, compilation_start);
+
+        // 4. We process the cell code via cling interpreter. This part is almost
+        // copied from xeus-cling implementation.
+        bool error_has_ocurred = false;
+        std::string error_name;
+        std::string error_value;
+        bool interrupted = false;
+        const std::size_t generation = declaration_generation;
+        committed_wrapper = nullptr;
+
+        // A cell that has already run without declaring anything, and since which
+        // nothing has been declared, is run again by calling the function cling has
+        // wrapped it into, without compiling it again.
+        void (*compiled_wrapper)(void*) = nullptr;
+        auto compiled = compiled_cells.find(code);
+        if (compiled != compiled_cells.end() && compiled->second.generation == generation &&
+            compiled->second.optimization_level == cling_interpreter.getDefaultOptLevel())
+        {
+            compiled_wrapper = compiled->second.wrapper;
+        }
+
+        // The transactions committed by the cell are recorded (see cell_history), so
+        // that it can be unloaded. If it does not compile because it redefines what the
+        // last cell that has declared something declares, e.g. because that cell has
+        // been edited and is executed again, that cell and the ones after it are
+        // unloaded and the cell is compiled again. Until then, its errors are held back.
+        // Redefinitions of what earlier cells declare are reported as they are.
+        std::optional<std::size_t> replaceable_cell;
+        if (compiled_wrapper == nullptr)
+        {
+            replaceable_cell = last_declaring_cell();
+        }
+        std::vector<executed_cell> replaced_cells;
+        cell_history.push_back({code, cling_interpreter.getLastTransaction(),
+            pagers.next_id()});
+        tracking_cell = true;
+
+        while (true)
+        {
+            std::optional<held_errors> held;
+            if (replaceable_cell && replaced_cells.empty())
+            {
+                held.emplace(cling_interpreter.getCI()->getDiagnostics());
+            }
+
+            try
+            {
+                interrupted = !run_interruptible([&]()
+                    {
+                        if (compiled_wrapper != nullptr)
+                        {
+                            execution_start_time = std::chrono::steady_clock::now();
+                            execution_started();
+                            compiled_wrapper(&output);
+                            compilation_result = cling::Interpreter::kSuccess;
+                        }
+                        else
+                        {
+                            compilation_result = cling_interpreter.process(
+                                cell_input(code), &output);
+                        }
+                    });
+            }
+            catch(const cling::InterpreterException& e)
+            {
+                error_has_ocurred = true;
+                error_name = "Interpreter Exception";
+                if (!e.diagnose())
+                {
+                    error_value = e.what();
+                }
+            }
+            catch (const std::exception& e)
+            {
+                error_has_ocurred = true;
+                error_name = "Standard Exception";
+                error_value = e.what();
+            }
+            catch (...)
+            {
+                error_has_ocurred = true;
+                error_name = "Unkown error";
+            }
+
+            if (held && held->redefinition() && !interrupted && !error_has_ocurred &&
+                compilation_result == cling::Interpreter::kFailure &&
+                !held->previous_definitions().empty() &&
+                in_files_of(cling_interpreter.getCI()->getSourceManager(),
+                    held->previous_definitions(),
+                    cell_history[*replaceable_cell].declarations))
+            {
+                held->discard();
+                executed_cell cell = std::move(cell_history.back());
+                cell_history.pop_back();
+                replaced_cells = unload_cells(*replaceable_cell);
+                cell.previous_transaction = cling_interpreter.getLastTransaction();
+                cell_history.push_back(std::move(cell));
+                continue;
+            }
+            break;
+        }
+
+        if (!replaced_cells.empty())
+        {
+            for (auto replaced = replaced_cells.rbegin(); replaced != replaced_cells.rend();
+                ++replaced)
+            {
+                if (replaced->journaled)
+                {
+                    journal.undo();
+                }
+            }
+
+            // The cells replaced are not compiled back behind the user's back if the
+            // cell does not compile either: the user is told to execute them again.
+            if (cell_history.back().transactions == 0)
+            {
+                publish_output("stderr", "Unloaded " +
+                    std::to_string(replaced_cells.size()) + " cells, the first of which "
+                    "declares what this cell redefines. Execute them again to restore "
+                    "what they have declared.\n");
+            }
+        }
+
+        // cling compiles the cell before running it; execution_start_time tells when it
+        // switched.
+        const cell_timing::clock::time_point processing_end = cell_timing::clock::now();
+        timing.add("compile", compilation_start,
+            execution_start_time.value_or(processing_end));
+        if (execution_start_time)
+        {
+            timing.add("execute", *execution_start_time, processing_end);
+        }
+
+        if (interrupted)
+        {
+            error_has_ocurred = true;
+            error_name = "Interrupted";
+            error_value = "The execution of the cell has been interrupted.";
+        }
+        else if (compilation_result != cling::Interpreter::kSuccess)
+        {
+            error_has_ocurred = true;
+            error_name = "Interpreter error";
+        }
+
+        // The cells that change the state of the interpreter are journaled, so that
+        // they can be replayed by another kernel.
+        const bool declares = declaration_generation != generation ||
+            has_preprocessor_directive(code);
+        const bool journaled = !error_has_ocurred && declares;
+        if (journaled)
+        {
+            journal.append(code, committed_wrapper != nullptr);
+        }
+
+        // The other ones are kept compiled (see compiled_cells), once the result has
+        // been displayed, since displaying it may declare a display thunk.
+        void* wrapper_address = nullptr;
+        if (!error_has_ocurred && !declares && compiled_wrapper == nullptr &&
+            committed_wrapper != nullptr)
+        {
+            wrapper_address = cling_interpreter.getAddressOfGlobal(
+                clang::GlobalDecl(committed_wrapper));
+        }
+
+        // 5. We revert std::cout and std::cerr outputs and we publish what is left
+        // of them.
+        cell_output.stop();
+        close_display_batches();
+        const cell_timing::clock::time_point output_end = cell_timing::clock::now();
+        timing.add("output", processing_end, output_end);
+
+        // 6. We publish the result or the error.
+        if (error_has_ocurred)
+        {
+            // If the exception did not explain anything, what the cell wrote into
+            // std::cerr probably does.
+            if (error_value.empty())
+            {
+                error_value = cell_output.error().recent_output(0);
+            }
+            std::vector<std::string> traceback({error_name + ": " + error_value});
+            publish([this, error_name, error_value, traceback]()
+                {
+                    publish_execution_error(error_name, error_value, traceback);
+                });
+
+            kernel_res["status"] = "error";
+            kernel_res["ename"] = error_name;
+            kernel_res["evalue"] = error_value;
+            kernel_res["traceback"] = traceback;
+        }
+        else
+        {
+            // 6.a. and 6.b. Everything written into std::cerr and std::cout has already
+            // been published as stream messages.
+
+            // 6.c. We display the last object as output if a semicolon was omitted
+            // in the last line.
+            if (output.hasValue() && code[code.find_last_not_of(' ')] != ';')
+            {
+                // We obtain a string representing the output type (with no reference types),
+                // i.e., we will never obtain int&, we will obtain int. 
+                std::string output_type = output.getType().getNonReferenceType().getAsString();
+
+                // This object is going to store the nl::json object returned by
+                // mime_representation.
+                nl::json output_mime_representation;
+
+                // Builtin arithmetic values are represented by the kernel itself.
+                if (builtin_mime_representation(output, display_preferencies,
+                    output_mime_representation))
+                {
+                    publish([this, execution_counter, output_mime_representation]()
+                        {
+                            publish_execution_result(execution_counter,
+                                output_mime_representation, nl::json::object());
+                        });
+                }
+                else
+                {
+                    // Again, we redirect std::cout and std::cerr outputs.
+                    const std::size_t error_start = cell_output.error().written();
+                    cell_output.start();
+
+                    // We obtain the function that computes the representation of this type,
+                    // which is only compiled the first time the type is displayed, and we call it.
+                    try
+                    {
+                        display_thunk thunk = get_display_thunk(output_type);
+                        if (thunk != nullptr)
+                        {
+                            // A copy of the value shares its storage, which the pager
+                            // of a summarized result keeps.
+                            void* object = value_address(output);
+                            displayed_result = std::shared_ptr<const void>(
+                                std::make_shared<const cling::Value>(output), object);
+                            thunk(object, &output_mime_representation);
+                        }
+                        else
+                        {
+                            compilation_result = cling::Interpreter::kFailure;
+                        }
+                    }
+                    catch(const cling::InterpreterException& e)
+                    {
+                        error_has_ocurred = true;
+                        error_name = "Interpreter Exception while evaluating output";
+                        if (!e.diagnose())
+                        {
+                            error_value = e.what();
+                        }
+                    }
+                    catch (const std::exception& e)
+                    {
+                        error_has_ocurred = true;
+                        error_name = "Standard Exception while evaluating output";
+                        error_value = e.what();
+                    }
+                    catch (...)
+                    {
+                        error_has_ocurred = true;
+                        error_name = "Unkown error while evaluating output";
+                    }
+                    displayed_result.reset();
+
+                    if (compilation_result != cling::Interpreter::kSuccess)
+                    {
+                        error_has_ocurred = true;
+                        error_name = "Interpreter error while evaluating output";
+                    }
+                
+                    // We revert std::cout and std::cerr outputs.
+                    cell_output.stop();
+
+                    if (error_has_ocurred)
+                    {
+                        if (error_value.empty())
+                        {
+                            error_value = cell_output.error().recent_output(error_start);
+                        }
+                        std::vector<std::string> traceback({error_name + ": " + error_value});
+                        publish([this, error_name, error_value, traceback]()
+                            {
+                                publish_execution_error(error_name, error_value, traceback);
+                            });
+
+                        kernel_res["status"] = "error";
+                        kernel_res["ename"] = error_name;
+                        kernel_res["evalue"] = error_value;
+                        kernel_res["traceback"] = traceback;
+                    }
+                    else
+                    {
+                        // Finally, we publish the evaluation of the output.
+                        publish([this, execution_counter, output_mime_representation]()
+                            {
+                                publish_execution_result(execution_counter,
+                                    output_mime_representation, nl::json::object());
+                            });
+                    }
+                }
+                timing.add("display", output_end, cell_timing::clock::now());
+            }
+
+            kernel_res["status"] = "ok";
+            kernel_res["payload"] = nl::json::array();
+            kernel_res["user_expressions"] = nl::json::object();
+        }
+
+        // The cell is kept in the history if it has compiled something.
+        tracking_cell = false;
+        if (cell_history.back().transactions == 0)
+        {
+            cell_history.pop_back();
+        }
+        else
+        {
+            cell_history.back().declares = declares;
+            cell_history.back().journaled = journaled;
+        }
+
+        if (wrapper_address != nullptr)
+        {
+            if (compiled_cells.size() >= max_compiled_cells)
+            {
+                compiled_cells.clear();
+            }
+            compiled_cells[code] = {declaration_generation,
+                cling_interpreter.getDefaultOptLevel(),
+                reinterpret_cast<void (*)(void*)>(wrapper_address)};
+        }
+
+        // 7. We report the timing of the cell.
+        kernel_res["als_xeus_cling"]["timing"] = timing.to_json();
+        kernel_res["als_xeus_cling"]["compiled"] = compiled_wrapper != nullptr;
+        kernel_res["als_xeus_cling"]["optimization"] = optimization_settings();
+        if (trace_writer* trace = session_trace())
+        {
+            trace->write(timing, execution_counter);
+        }
+        if (report_timing)
+        {
+            publish_output("stdout", timing.report());
+        }
+
+        return kernel_res;
+    }
+
+    nl::json interpreter::ok_reply() const
+    {
+        nl::json kernel_res;
+        kernel_res["status"] = "ok";
+        kernel_res["payload"] = nl::json::array();
+        kernel_res["user_expressions"] = nl::json::object();
+        return kernel_res;
+    }
+
+    nl::json interpreter::error_reply(const std::string& name, const std::string& value)
+    {
+        std::vector<std::string> traceback({name + ": " + value});
+        publish([this, name, value, traceback]()
+            {
+                publish_execution_error(name, value, traceback);
+            });
+
+        nl::json kernel_res;
+        kernel_res["status"] = "error";
+        kernel_res["ename"] = name;
+        kernel_res["evalue"] = value;
+        kernel_res["traceback"] = traceback;
+        return kernel_res;
+    }
+
+    nl::json interpreter::timeit_magic(const magic_command& command, int execution_counter)
+    {
+        const std::string& statement = command.is_cell_magic ? command.body :
+            command.arguments;
+        if (statement.find_first_not_of(" \t\n") == std::string::npos)
+        {
+            return error_reply("UsageError", "Nothing to time.");
+        }
+
+        output_capture timeit_output([this](const std::string& text)
+            {
+                publish_output("stdout", text);
+            },
+            [this](const std::string& text)
+            {
+                publish_output("stderr", text);
+            }, stream_limits);
+        timeit_output.start();
+
+        // The statement becomes the body of a function, declared extern "C" so that
+        // its symbol is its name.
+        const std::string name = "__xcpp_timeit_" + std::to_string(timeit_counter++);
+        void (*function)() = nullptr;
+        {
+            std::lock_guard<std::mutex> compilation_lock(compilation_mutex);
+            function = reinterpret_cast<void (*)()>(cling_interpreter.compileFunction(name,
+                "extern \"C\" void " + name + "()\n{\n" + statement + ";\n}\n",
+                false, false));
+        }
+        if (function == nullptr)
+        {
+            timeit_output.stop();
+            return error_reply("Interpreter error", timeit_output.error().recent_output(0));
+        }
+
+        timeit_result result;
+        std::string error_name;
+        std::string error_value;
+        try
+        {
+            if (!run_interruptible([&]()
+                {
+                    execution_started();
+                    result = timeit(function);
+                }))
+            {
+                error_name = "Interrupted";
+                error_value = "The execution of the cell has been interrupted.";
+            }
+        }
+        catch (const std::exception& e)
+        {
+            error_name = "Standard Exception";
+            error_value = e.what();
+        }
+        catch (...)
+        {
+            error_name = "Unkown error";
+        }
+        timeit_output.stop();
+
+        if (!error_name.empty())
+        {
+            return error_reply(error_name, error_value);
+        }
+
+        publish_output("stdout", result.report());
+        nl::json kernel_res = ok_reply();
+        kernel_res["als_xeus_cling"]["timeit"] = result.to_json();
+        kernel_res["als_xeus_cling"]["optimization"] = optimization_settings();
+        return kernel_res;
+    }
+
+    nl::json interpreter::optimize_magic(const magic_command& command, int execution_counter)
+    {
+        if (command.arguments.find("march") != std::string::npos)
+        {
+            return error_reply("UsageError", "The target CPU can only be chosen when the "
+                "kernel starts, with -march in the argv of kernel.json.");
+        }
+
+        // We accept both "2" and "-O2".
+        std::string_view level_text = command.arguments;
+        if (level_text.substr(0, 2) == "-O")
+        {
+            level_text.remove_prefix(2);
+        }
+        if (level_text.empty() && !command.is_cell_magic)
+        {
+            publish_output("stdout", optimization_settings().dump() + "\n");
+            nl::json kernel_res = ok_reply();
+            kernel_res["als_xeus_cling"]["optimization"] = optimization_settings();
+            return kernel_res;
+        }
+        if (level_text.size() != 1 || level_text[0] < '0' || level_text[0] > '3')
+        {
+            return error_reply("UsageError", "Usage: %optimize [0-3] or %%optimize 0-3.");
+        }
+        const int level = level_text[0] - '0';
+
+        if (!command.is_cell_magic)
+        {
+            {
+                std::lock_guard<std::mutex> compilation_lock(compilation_mutex);
+                cling_interpreter.setDefaultOptLevel(level);
+            }
+            nl::json kernel_res = ok_reply();
+            kernel_res["als_xeus_cling"]["optimization"] = optimization_settings();
+            return kernel_res;
+        }
+
+        // %%optimize only applies to the body of the cell.
+        optimization_level_guard level_guard(cling_interpreter, compilation_mutex, level);
+        return execute_cell(execution_counter, command.body, false, true,
+            nl::json::object(), false, false);
+    }
+
+    nl::json interpreter::optimization_settings() const
+    {
+        nl::json res;
+        res["level"] = cling_interpreter.getDefaultOptLevel();
+        res["target_cpu"] = options.target_cpu.empty() ? "default" : options.target_cpu;
+        return res;
+    }
+
+    void interpreter::transaction_committed(const cling::Transaction& transaction)
+    {
+        // The cell must not be interrupted while cling commits.
+        interrupt_guard guard;
+
+        // We keep track of what is declared, in order to rank completions and to know
+        // when cached completions are no longer valid.
+        if (tracking_cell && !transaction.isNestedTransaction())
+        {
+            ++cell_history.back().transactions;
+        }
+
+        bool declares = false;
+        for (auto call = transaction.decls_begin(); call != transaction.decls_end(); ++call)
+        {
+            if (call->m_Call != cling::Transaction::kCCIHandleTopLevelDecl)
+            {
+                continue;
+            }
+            for (clang::Decl* declaration : call->m_DGR)
+            {
+                if (declaration == transaction.getWrapperFD())
+                {
+                    continue;
+                }
+                declares = true;
+                if (tracking_cell)
+                {
+                    symbols.add(declaration);
+                    cell_history.back().declarations.push_back(declaration);
+                }
+                else
+                {
+                    unindexed_declarations.insert(declaration);
+                }
+
+                const clang::NamedDecl* named = llvm::dyn_cast<clang::NamedDecl>(declaration);
+                if (named != nullptr && named->getIdentifier() != nullptr &&
+                    is_cell_declaration(named))
+                {
+                    user_declarations.insert(named->getNameAsString());
+                }
+            }
+        }
+        if (declares)
+        {
+            ++declaration_generation;
+        }
+
+        // The wrapper of a cell is run right after its transaction has been committed.
+        if (!transaction.isNestedTransaction() && transaction.getWrapperFD() != nullptr)
+        {
+            if (tracking_cell && !execution_start_time)
+            {
+                // Only the wrapper of the cell itself, not of the code it may process.
+                committed_wrapper = transaction.getWrapperFD();
+                execution_start_time = std::chrono::steady_clock::now();
+            }
+            execution_started();
+        }
+    }
+
+    void interpreter::publish_output(const std::string& name, const std::string& text)
+    {
+        if (replaying)
+        {
+            return;
+        }
+        publish([this, name, text]()
+            {
+                flush_display_batch();
+                send_stream(name, text);
+            });
+    }
+
+    void interpreter::publish_display(nl::json data, nl::json metadata, nl::json transient)
+    {
+        if (replaying)
+        {
+            return;
+        }
+        // The limits belong to the cell, so they are read by the thread displaying, not
+        // by the shell thread.
+        publish([this, data = std::move(data), metadata = std::move(metadata),
+            transient = std::move(transient),
+            batch_interval = display_budget.batch_interval]() mutable
+            {
+                // Only displays made of a single text representation can be merged, and
+                // only with those of the cell being executed.
+                if (display_batch_depth > 0 && late_parent == nullptr &&
+                    metadata.empty() && transient.empty() &&
+                    data.size() == 1 && data.begin().value().is_string() &&
+                    (data.begin().key() == "text/plain" || data.begin().key() == "text/latex"))
+                {
+                    if (data.begin().key() != batched_mime_type)
+                    {
+                        flush_display_batch();
+                        batched_mime_type = data.begin().key();
+                    }
+                    if (batched_displays.empty())
+                    {
+                        batch_deadline = std::chrono::steady_clock::now() + batch_interval;
+                    }
+                    batched_displays.push_back(data.begin().value().get<std::string>());
+                    batched_bytes += batched_displays.back().size();
+
+                    if (batched_bytes >= max_batch_bytes ||
+                        std::chrono::steady_clock::now() >= batch_deadline)
+                    {
+                        flush_display_batch();
+                    }
+                    return;
+                }
+
+                flush_display_batch();
+                send_display("display_data", std::move(data), std::move(metadata),
+                    std::move(transient));
+            });
+    }
+
+    void interpreter::publish_display_update(nl::json data, nl::json metadata,
+        nl::json transient)
+    {
+        if (replaying)
+        {
+            return;
+        }
+        publish([this, data = std::move(data), metadata = std::move(metadata),
+            transient = std::move(transient)]() mutable
+            {
+                flush_display_batch();
+                send_display("update_display_data", std::move(data), std::move(metadata),
+                    std::move(transient));
+            });
+    }
+
+    void interpreter::publish_array(const void* data, std::size_t size,
+        const std::string& dtype, const std::vector<std::size_t>& shape, bool compress)
+    {
+        if (replaying)
+        {
+            return;
+        }
+
+        // The buffer is built (and compressed) by the calling thread, so that several
+        // threads can do it in parallel.
+        nl::json header;
+        header["dtype"] = dtype;
+        header["shape"] = shape;
+        header["byte_order"] = (htonl(1) == 1) ? "big" : "little";
+        header["size"] = size;
+
+        const char* bytes = static_cast<const char*>(data);
+        xeus::buffer_sequence buffers(1);
+        if (compress)
+        {
+            buffers[0] = compress_buffer(bytes, size);
+        }
+        if (buffers[0].empty())
+        {
+            buffers[0].assign(bytes, bytes + size);
+            header["compression"] = "none";
+        }
+        else
+        {
+            header["compression"] = "zlib";
+        }
+
+        std::string dimensions;
+        for (std::size_t i = 0; i < shape.size(); ++i)
+        {
+            dimensions += (i == 0 ? "" : "x") + std::to_string(shape[i]);
+        }
+
+        publish([this, header = std::move(header), buffers = std::move(buffers), dtype,
+            dimensions = std::move(dimensions), size]() mutable
+            {
+                flush_display_batch();
+
+                // Without a frontend (see run_notebooks), there are no comms, so only
+                // the description of the array is displayed.
+                if (!configured)
+                {
+                    nl::json display;
+                    display["text/plain"] = "array<" + dtype + ">[" + dimensions + "] (" +
+                        std::to_string(size) + " bytes)";
+                    send_display("display_data", std::move(display), nl::json::object(),
+                        nl::json::object());
+                    return;
+                }
+
+                // The comm is only used to carry the buffer, so it is closed right away.
+                xeus::xcomm comm(comm_manager().target(array_comm_target),
+                    xeus::new_xguid());
+                header["comm_id"] = comm.id();
+                comm.open(nl::json::object(), header, std::move(buffers));
+                comm.close(nl::json::object(), nl::json::object(), {});
+
+                nl::json display;
+                display["text/plain"] = "array<" + dtype + ">[" + dimensions + "] (" +
+                    std::to_string(size) + " bytes sent as a binary buffer)";
+                display["application/vnd.als-xeus-cling.array+json"] = std::move(header);
+                send_display("display_data", std::move(display), nl::json::object(),
+                    nl::json::object());
+            });
+    }
+
+    std::string interpreter::new_display_id()
+    {
+        // The process id keeps the ids of a restarted kernel apart from the old ones.
+        return "als-xeus-cling-" + std::to_string(getpid()) + "-" +
+            std::to_string(display_id_counter++);
+    }
+
+    void interpreter::begin_display_batch()
+    {
+        publish([this]()
+            {
+                ++display_batch_depth;
+            });
+    }
+
+    void interpreter::end_display_batch()
+    {
+        publish([this]()
+            {
+                if (display_batch_depth > 0 && --display_batch_depth == 0)
+                {
+                    flush_display_batch();
+                }
+            });
+    }
+
+    void interpreter::close_display_batches()
+    {
+        publish([this]()
+            {
+                display_batch_depth = 0;
+                flush_display_batch();
+            });
+    }
+
+    void interpreter::publish(std::function<void()> message)
+    {
+        // The cell must not be interrupted while it pushes, which would leave the queue
+        // broken.
+        interrupt_guard guard;
+        publications.push({publishing_cell(), std::move(message)});
+    }
+
+    std::size_t interpreter::publishing_cell() const
+    {
+        if (worker::on_worker_thread())
+        {
+            return started_cells;
+        }
+        thread_local std::size_t first_cell = 0;
+        if (first_cell == 0)
+        {
+            first_cell = started_cells;
+        }
+        return first_cell;
+    }
+
+    void interpreter::register_parented_publisher(parented_publisher publisher)
+    {
+        late_publisher = std::move(publisher);
+    }
+
+    void interpreter::drain_publications()
+    {
+        while (std::optional<publication> message = publications.pop())
+        {
+            // Messages queued before the first cell belong to no cell.
+            if (late_publisher && message->cell != 0 && message->cell != active_cell)
+            {
+                auto parent = cell_parents.find(message->cell);
+                if (parent != cell_parents.end())
+                {
+                    late_parent = &parent->second;
+                }
+            }
+            message->send();
+            late_parent = nullptr;
+        }
+
+        // A batch is published once it is old enough, even if the cell has stopped
+        // displaying, e.g. while it computes the next rows.
+        if (!batched_displays.empty() &&
+            std::chrono::steady_clock::now() >= batch_deadline)
+        {
+            flush_display_batch();
+        }
+    }
+
+    void interpreter::send_stream(const std::string& name, const std::string& text)
     {
-        // 1. We create the return value.
-        nl::json kernel_res;
-
-        // 2. We prepare cling objects for the cling interpreter.
-        cling::Value output;
-        cling::Interpreter::CompilationResult compilation_result =
-            cling::Interpreter::kFailure;
+        if (late_parent == nullptr)
+        {
+            publish_stream(name, text);
+            return;
+        }
 
-        // 3. We redirect std::cout and std::cerr outputs.
-        std::stringstream output_buffer;
-        std::stringstream error_buffer;
-        // This next line saves old cerr buffer into old_error and writes the new one
-        // simultanously.
-        std::streambuf* old_output = std::cout.rdbuf(output_buffer.rdbuf());
-        std::streambuf* old_error = std::cerr.rdbuf(error_buffer.rdbuf());
+        nl::json content;
+        content["name"] = name;
+        content["text"] = text;
+        late_publisher("stream", *late_parent, nl::json::object(), std::move(content), {});
+    }
 
-        // 4. We process the cell code via cling interpreter. This part is almost
-        // copied from xeus-cling implementation.
-        bool error_has_ocurred = false;
-        std::string error_name;
-        try
+    void interpreter::send_display(const std::string& msg_type, nl::json data,
+        nl::json metadata, nl::json transient)
+    {
+        if (late_parent == nullptr)
         {
-            // If last line of code does not start with "#", we add a semicolon at the end.
-            if (code[code.find_last_of("\n") + 1] != '#')
+            if (msg_type == "update_display_data")
             {
-                compilation_result = cling_interpreter.process(code + ";", &output);
+                update_display_data(std::move(data), std::move(metadata),
+                    std::move(transient));
             }
             else
             {
-                compilation_result = cling_interpreter.process(code, &output);
+                display_data(std::move(data), std::move(metadata), std::move(transient));
             }
-            
+            return;
         }
-        catch(const cling::InterpreterException& e)
+
+        nl::json content;
+        content["data"] = std::move(data);
+        content["metadata"] = std::move(metadata);
+        content["transient"] = std::move(transient);
+        late_publisher(msg_type, *late_parent, nl::json::object(), std::move(content), {});
+    }
+
+    void interpreter::flush_display_batch()
+    {
+        if (batched_displays.empty())
         {
-            error_has_ocurred = true;
-            error_name = "Interpreter Exception";
-            if (!e.diagnose())
+            return;
+        }
+
+        nl::json data;
+        if (batched_displays.size() == 1)
+        {
+            data[batched_mime_type] = std::move(batched_displays.front());
+        }
+        else if (batched_mime_type == "text/latex")
+        {
+            // Every representation is a formula between dollars. They become the rows
+            // of a single array.
+            std::string latex = "$\\begin{array}{l}\n";
+            for (std::size_t i = 0; i < batched_displays.size(); ++i)
             {
-                std::cerr << e.what();
+                std::string_view row = batched_displays[i];
+                if (row.size() >= 2 && row.front() == '$' && row.back() == '$')
+                {
+                    row = row.substr(1, row.size() - 2);
+                }
+                latex.append(row);
+                latex += (i + 1 < batched_displays.size()) ? " \\\\\n" : "\n";
             }
+            latex += "\\end{array}$";
+            data[batched_mime_type] = std::move(latex);
         }
-        catch (const std::exception& e)
+        else
         {
-            error_has_ocurred = true;
-            error_name = "Standard Exception";
-            std::cerr << e.what();
+            std::string plain;
+            for (std::size_t i = 0; i < batched_displays.size(); ++i)
+            {
+                if (i > 0)
+                {
+                    plain += '\n';
+                }
+                plain += batched_displays[i];
+            }
+            data[batched_mime_type] = std::move(plain);
         }
-        catch (...)
+
+        batched_displays.clear();
+        batched_bytes = 0;
+        display_data(std::move(data), nl::json::object(), nl::json::object());
+    }
+
+    interpreter::display_thunk interpreter::get_display_thunk(const std::string& type)
+    {
+        auto cached_thunk = display_thunks.find(type);
+        if (cached_thunk != display_thunks.end())
         {
-            error_has_ocurred = true;
-            error_name = "Unkown error";
+            return cached_thunk->second;
         }
 
-        if (compilation_result != cling::Interpreter::kSuccess)
+        // The function is declared extern "C" so that its symbol is its name.
+        std::stringstream name;
+        name << "__xcpp_repr_" << std::hex << std::hash<std::string>()(type);
+        std::stringstream thunk_code;
+        thunk_code << "extern \"C\" void " << name.str() << "(void* object, void* result)\n"
+            << "{\n"
+            << "    *static_cast<nl::json*>(result) = als::xeus_cling::mime_representation(\n"
+            << "        *static_cast<" << type << "*>(object), xci->display_preferencies);\n"
+            << "}\n";
+
+        display_thunk thunk = reinterpret_cast<display_thunk>(
+            cling_interpreter.compileFunction(name.str(), thunk_code.str(), false, false));
+        // Failures are not cached, so that the type can be displayed once the user
+        // has declared what is missing.
+        if (thunk != nullptr)
         {
-            error_has_ocurred = true;
-            error_name = "Interpreter error";
+            display_thunks.emplace(type, thunk);
+            if (tracking_cell)
+            {
+                cell_history.back().display_thunk_types.push_back(type);
+            }
         }
+        return thunk;
+    }
 
-        // 5. We revert std::cout and std::cerr outputs.
-        std::cout.rdbuf(old_output);
-        std::cerr.rdbuf(old_error);
+    void interpreter::configure_impl()
+    {
+        configured = true;
 
-        // 6. We publish the result or the error.
-        if (error_has_ocurred)
+        // The libraries and headers are preloaded on the worker, before any cell, while
+        // the kernel already answers the other requests.
+        if (!options.preload_libraries.empty() || !options.preload_headers.empty())
         {
-            std::vector<std::string> traceback({error_name + ": " + error_buffer.str()});
-            publish_execution_error(error_name, error_buffer.str(), traceback);
+            cell_worker.post([this]() { preload(); });
+        }
 
-            kernel_res["status"] = "error";
-            kernel_res["ename"] = error_name;
-            kernel_res["evalue"] = error_buffer.str();
-            kernel_res["traceback"] = traceback;
+        // The session of a kernel that crashed is recovered before the first cell,
+        // unless it crashed while recovering a session.
+        if (journal.previous_crashed_code())
+        {
+            std::clog << "als-xeus-cling-kernel: not replaying the code that was running "
+                "when the previous kernel stopped:\n" << *journal.previous_crashed_code()
+                << std::endl;
         }
-        else
+        if (journal.previous_crashed_replaying())
+        {
+            std::clog << "als-xeus-cling-kernel: the previous kernel crashed while "
+                "replaying its journal, %replay replays it" << std::endl;
+        }
+        else if (journal.previous_crashed())
         {
-            // 6.a. We publish all captured std:cerr output.
-            if (!error_buffer.str().empty())
+            cell_worker.post([this]()
+                {
+                    const auto replay_start = std::chrono::steady_clock::now();
+                    const std::vector<journaled_cell> cells =
+                        journal.take_previous_cells();
+                    const std::size_t failed = replay(cells);
+                    std::clog << "als-xeus-cling-kernel: replayed " << cells.size()
+                        << " cells in " << std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - replay_start).count()
+                        << " ms (" << failed << " failed)" << std::endl;
+                });
+        }
+
+        // Arrays are only sent by the kernel (see publish_array), so the comms opened
+        // by the frontend with this target are ignored.
+        comm_manager().register_comm_target(array_comm_target,
+            [](xeus::xcomm&&, const xeus::xmessage&) {});
+
+        comm_manager().register_comm_target(pager_comm_target,
+            [this](xeus::xcomm&& comm, const xeus::xmessage& request)
             {
-                nl::json warnings;
-                warnings["text/plain"] = "Execution of the cell has captured the following errors:\n"
-                    + error_buffer.str();
-                display_data(warnings, nl::json::object(), nl::json::object());
-            }
+                answer_page_request(std::move(comm), request);
+            });
+    }
+
+    void interpreter::preload()
+    {
+        const auto preload_start = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> compilation_lock(compilation_mutex);
+        if (preloaded)
+        {
+            return;
+        }
+        preloaded = true;
+        forget_cell_history();
 
-            // 6.b. We publish all captured std::cout output.
-            if (!output_buffer.str().empty())
+        for (const std::string& library : options.preload_libraries)
+        {
+            if (cling_interpreter.loadLibrary(library, true) !=
+                cling::Interpreter::kSuccess)
+            {
+                std::clog << "als-xeus-cling-kernel: could not load " << library << std::endl;
+            }
+        }
+        for (const std::string& header : options.preload_headers)
+        {
+            if (cling_interpreter.process("#include \"" + header + "\"", nullptr, nullptr,
+                false) != cling::Interpreter::kSuccess)
             {
-                nl::json text_output;
-                text_output["text/plain"] = "Execution of the cell has captured the following outputs:\n"
-                    + output_buffer.str();
-                display_data(text_output, nl::json::object(), nl::json::object());
+                std::clog << "als-xeus-cling-kernel: could not include " << header << std::endl;
             }
+        }
 
-            // 6.c. We display the last object as output if a semicolon was omitted
-            // in the last line.
-            if (output.hasValue() && code[code.find_last_not_of(' ')] != ';')
+        std::clog << "als-xeus-cling-kernel: preloaded in "
+            << std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - preload_start).count()
+            << " ms" << std::endl;
+    }
+
+    void interpreter::open_journal(const std::string& path)
+    {
+        if (!journal.open(path))
+        {
+            std::clog << "als-xeus-cling-kernel: could not create the journal " << path
+                << std::endl;
+        }
+    }
+
+    std::size_t interpreter::replay(const std::vector<journaled_cell>& cells)
+    {
+        std::lock_guard<std::mutex> compilation_lock(compilation_mutex);
+        forget_cell_history();
+        replaying = true;
+        // What the cells write is dropped.
+        output_capture replay_output([](const std::string&) {}, [](const std::string&) {},
+            stream_limits);
+        replay_output.start();
+
+        auto process = [this](const std::string& input)
             {
-                // We define the object that is going to be displayed as output.
-                nl::json result;
-                
-                // We obtain a string representing the output type (with no reference types),
-                // i.e., we will never obtain int&, we will obtain int. 
-                std::string output_type = output.getType().getNonReferenceType().getAsString();
-                
-                // This pointer will point to the adress where our output is stored.
-                void* output_adress = nullptr;
-                // Because of how cling works, objects are stored differently depending on their
-                // type. If our object is of one of the types listed below, the cling::Value object
-                // contains its actual value and not a pointer to it. In all other cases,
-                // cling::Value object stores a pointer to our object.
-                if (output_type == "float")
-                {
-                    output_adress = &output.getFloat();
-                }
-                else if (output_type == "double")
-                {
-                    output_adress = &output.getDouble();
-                }
-                else if (output_type == "long double")
-                {
-                    output_adress = &output.getLongDouble();
-                }
-                else if (output_type == "char" ||
-                         output_type == "int" ||
-                         output_type == "long int" ||
-                         output_type == "long long int")
+                try
                 {
-                    output_adress = &output.getLL();
+                    return cling_interpreter.process(input, nullptr, nullptr, true) ==
+                        cling::Interpreter::kSuccess;
                 }
-                else if (output_type == "unsigned char" ||
-                         output_type == "unsigned int" ||
-                         output_type == "unsigned long int" ||
-                         output_type == "unsigend long long int")
+                catch (...)
                 {
-                    output_adress = &output.getULL();
+                    return false;
                 }
-                else
+            };
+
+        // Consecutive cells that only declare are compiled as one transaction, which is
+        // much faster than one each. The cells with statements are replayed alone, since
+        // cling would run the statements of a batch after the initializers of all its
+        // global variables, and so are the cells with preprocessor directives, which
+        // must not end up in the function cling wraps the statements into. If a batch
+        // fails, it is rolled back and its cells are replayed one by one.
+        auto batchable = [](const journaled_cell& cell)
+            {
+                return !cell.statements && !has_preprocessor_directive(cell.code);
+            };
+        // The journal tells which cells were being replayed if the kernel crashes, so
+        // that the next kernel does not replay them.
+        journal.begin_replay(cells);
+        std::size_t failed = 0;
+        std::size_t begin = 0;
+        while (begin < cells.size())
+        {
+            std::size_t end = begin + 1;
+            if (batchable(cells[begin]))
+            {
+                while (end < cells.size() && batchable(cells[end]))
                 {
-                    output_adress = output.getPtr();
+                    ++end;
                 }
+            }
 
-                // This cling::Value is going to store the nl::json object returned by
-                // mime_representation.
-                cling::Value output_mime_representation;
-                // This is the code that is going to be compiled to obtain the representation.
-                std::stringstream representation_code;
-                representation_code << "als::xeus_cling::mime_representation(*("
-                    << output_type << "*)"
-                    << output_adress << ", xci->display_preferencies);;";
-
-                // Again, we redirect std::cout and std::cerr outputs.
-                output_buffer.clear();
-                error_buffer.clear();
-                old_output = std::cout.rdbuf(output_buffer.rdbuf());
-                old_error = std::cerr.rdbuf(error_buffer.rdbuf());
-
-                // We try to compile the representation code.
-                try
+            std::string batch;
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                batch += cell_input(cells[i].code) + "\n";
+            }
+            journal.replaying(begin, end - begin);
+            if (end - begin > 1 && process(batch))
+            {
+                for (std::size_t i = begin; i < end; ++i)
                 {
-                    cling_interpreter.process(representation_code.str(), &output_mime_representation,
-                        nullptr, false);
+                    journal.append(cells[i].code, cells[i].statements);
                 }
-                catch(const cling::InterpreterException& e)
+            }
+            else
+            {
+                for (std::size_t i = begin; i < end; ++i)
                 {
-                    error_has_ocurred = true;
-                    error_name = "Interpreter Exception while evaluating output";
-                    if (!e.diagnose())
+                    if (end - begin > 1)
                     {
-                        std::cerr << e.what();
+                        journal.replaying(i, 1);
+                    }
+                    if (process(cell_input(cells[i].code)))
+                    {
+                        journal.append(cells[i].code, cells[i].statements);
+                    }
+                    else
+                    {
+                        ++failed;
                     }
                 }
-                catch (const std::exception& e)
-                {
-                    error_has_ocurred = true;
-                    error_name = "Standard Exception while evaluating output";
-                    std::cerr << e.what();
-                }
-                catch (...)
-                {
-                    error_has_ocurred = true;
-                    error_name = "Unkown error while evaluating output";
-                }
+            }
+            begin = end;
+        }
+        journal.end_replay();
 
-                if (compilation_result != cling::Interpreter::kSuccess)
-                {
-                    error_has_ocurred = true;
-                    error_name = "Interpreter error while evaluating output";
-                }
-                
-                // We revert std::cout and std::cerr outputs.
-                std::cout.rdbuf(old_output);
-                std::cerr.rdbuf(old_error);
+        replay_output.stop();
+        close_display_batches();
+        replaying = false;
+        return failed;
+    }
 
-                if (error_has_ocurred)
-                {
-                    std::vector<std::string> traceback({error_name + ": " + error_buffer.str()});
-                    publish_execution_error(error_name, error_buffer.str(), traceback);
+    nl::json interpreter::replay_magic(const magic_command&, int)
+    {
+        if (journal.previous_crashed_code())
+        {
+            publish_output("stdout", "Not replaying the code that was running when the "
+                "previous kernel stopped:\n" + *journal.previous_crashed_code() + "\n");
+        }
+        const std::vector<journaled_cell> cells = journal.take_previous_cells();
+        if (cells.empty())
+        {
+            publish_output("stdout", journal.is_open() ? "Nothing to replay.\n" :
+                "No journal: the kernel must be started with --journal.\n");
+            return ok_reply();
+        }
 
-                    kernel_res["status"] = "error";
-                    kernel_res["ename"] = error_name;
-                    kernel_res["evalue"] = error_buffer.str();
-                    kernel_res["traceback"] = traceback;
-                }
-                else
+        const auto replay_start = std::chrono::steady_clock::now();
+        const std::size_t failed = replay(cells);
+        publish_output("stdout", "Replayed " + std::to_string(cells.size()) +
+            " cells in " + format_duration(std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - replay_start).count()) + " (" +
+            std::to_string(failed) + " failed).\n");
+        return ok_reply();
+    }
+
+    std::optional<std::size_t> interpreter::last_declaring_cell() const
+    {
+        for (std::size_t i = cell_history.size(); i > 0; --i)
+        {
+            if (cell_history[i - 1].declares)
+            {
+                return i - 1;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::vector<interpreter::executed_cell> interpreter::unload_cells(std::size_t first)
+    {
+        std::vector<executed_cell> res(std::make_move_iterator(cell_history.begin() + first),
+            std::make_move_iterator(cell_history.end()));
+        cell_history.erase(cell_history.begin() + first, cell_history.end());
+        if (res.empty())
+        {
+            return res;
+        }
+
+        // What refers to the declarations and the code of the cells is forgotten before
+        // they are unloaded.
+        for (const executed_cell& cell : res)
+        {
+            for (const std::string& type : cell.display_thunk_types)
+            {
+                display_thunks.erase(type);
+            }
+        }
+        pagers.remove_since(res.front().first_pager);
+
+        // Every transaction since the first cell is unloaded, including those no cell
+        // has recorded (e.g. the function compiled by %timeit, or the instantiations
+        // made by an inspection), so the index forgets the declarations of each of them.
+        std::set<std::string> names;
+        const std::size_t resident_before = resident_memory();
+        const cling::Transaction* previous_transaction = res.front().previous_transaction;
+        while (cling_interpreter.getLastTransaction() != nullptr &&
+            cling_interpreter.getLastTransaction() != previous_transaction)
+        {
+            for_each_top_level_declaration(*cling_interpreter.getLastTransaction(),
+                [&](const clang::Decl* declaration)
                 {
-                    // We publish all captured std:cerr output.
-                    if (!error_buffer.str().empty())
+                    if (unindexed_declarations.erase(declaration) == 0)
                     {
-                        nl::json warnings;
-                        warnings["text/plain"] = "Evaluation of the output has captured the following errors:\n"
-                            + error_buffer.str();
-                        display_data(warnings, nl::json::object(), nl::json::object());
+                        symbols.remove(declaration);
                     }
-
-                    // We publish all captured std::cout output.
-                    if (!output_buffer.str().empty())
+                    const clang::NamedDecl* named =
+                        llvm::dyn_cast<clang::NamedDecl>(declaration);
+                    if (named != nullptr && named->getIdentifier() != nullptr)
                     {
-                        nl::json text_output;
-                        text_output["text/plain"] = "Evaluation of the output has captured the following outputs:\n"
-                            + output_buffer.str();
-                        display_data(text_output, nl::json::object(), nl::json::object());
+                        names.insert(named->getNameAsString());
                     }
+                });
+            cling_interpreter.unload(1);
+            ++unloaded_transactions;
+        }
+        // The allocator keeps the memory of the unloaded code unless asked.
+        malloc_trim(0);
+        const std::size_t resident_after = resident_memory();
+        if (resident_after < resident_before)
+        {
+            freed_bytes += resident_before - resident_after;
+        }
+        unloaded_cells += res.size();
 
-                    // Finally, we publish the evaluation of the output.
-                    publish_execution_result(execution_counter,
-                        *(nl::json*)output_mime_representation.getPtr(), nl::json::object());
-                }
+        // The names are still declared if another cell declares them.
+        for (const std::string& name : names)
+        {
+            const std::vector<const clang::NamedDecl*> declarations = symbols.find(name);
+            if (std::none_of(declarations.begin(), declarations.end(),
+                [](const clang::NamedDecl* declaration)
+                {
+                    return is_cell_declaration(declaration);
+                }))
+            {
+                user_declarations.erase(name);
             }
+        }
+        // Cached completions and compiled cells may refer to what has been unloaded.
+        ++declaration_generation;
+        return res;
+    }
 
-            kernel_res["status"] = "ok";
-            kernel_res["payload"] = nl::json::array();
-            kernel_res["user_expressions"] = nl::json::object();
+    std::vector<const clang::NamedDecl*> interpreter::find_declarations(
+        const std::string& name)
+    {
+        std::vector<const clang::NamedDecl*> res = symbols.find(name);
+        if (res.empty() && !unindexed_declarations.empty())
+        {
+            for (const clang::Decl* declaration : unindexed_declarations)
+            {
+                symbols.add(declaration);
+            }
+            unindexed_declarations.clear();
+            res = symbols.find(name);
+        }
+        return res;
+    }
+
+    void interpreter::forget_cell_history()
+    {
+        cell_history.clear();
+    }
+
+    nl::json interpreter::unload_magic(const magic_command& command, int)
+    {
+        std::unique_lock<std::mutex> compilation_lock(compilation_mutex);
+        std::optional<std::size_t> first;
+        if (command.name == "reset")
+        {
+            first = 0;
+        }
+        else
+        {
+            first = last_declaring_cell();
+        }
+        const std::size_t freed_before = freed_bytes;
+        const std::vector<executed_cell> unloaded = first ?
+            unload_cells(*first) : std::vector<executed_cell>{};
+        for (auto cell = unloaded.rbegin(); cell != unloaded.rend(); ++cell)
+        {
+            if (cell->journaled)
+            {
+                journal.undo();
+            }
+        }
+        const std::size_t freed = freed_bytes - freed_before;
+        compilation_lock.unlock();
+
+        if (unloaded.empty())
+        {
+            publish_output("stdout", "Nothing to unload.\n");
+        }
+        else
+        {
+            std::size_t transactions = 0;
+            for (const executed_cell& cell : unloaded)
+            {
+                transactions += cell.transactions;
+            }
+            std::ostringstream report;
+            report << "Unloaded " << unloaded.size() << " cells (" << transactions
+                << " transactions), " << std::fixed << std::setprecision(1)
+                << double(freed) / (1024 * 1024) << " MiB freed.\n";
+            publish_output("stdout", report.str());
+        }
+        return ok_reply();
+    }
+
+    nl::json interpreter::memory_report() const
+    {
+        std::size_t transactions = 0;
+        for (const executed_cell& cell : cell_history)
+        {
+            transactions += cell.transactions;
         }
+        nl::json res;
+        res["resident_bytes"] = resident_memory();
+        res["cells"] = cell_history.size();
+        res["transactions"] = transactions;
+        res["declarations"] = symbols.size();
+        res["unloaded_cells"] = unloaded_cells;
+        res["unloaded_transactions"] = unloaded_transactions;
+        res["freed_bytes"] = freed_bytes;
+        return res;
+    }
+
+    nl::json interpreter::memory_magic(const magic_command&, int)
+    {
+        std::unique_lock<std::mutex> compilation_lock(compilation_mutex);
+        const nl::json report = memory_report();
+        compilation_lock.unlock();
+
+        auto mebibytes = [](std::size_t bytes)
+            {
+                std::ostringstream res;
+                res << std::fixed << std::setprecision(1) << double(bytes) / (1024 * 1024)
+                    << " MiB";
+                return res.str();
+            };
+        std::ostringstream text;
+        text << "Resident memory:      "
+            << mebibytes(report["resident_bytes"].get<std::size_t>()) << "\n"
+            << "Unloadable cells:     " << report["cells"] << " ("
+            << report["transactions"] << " transactions)\n"
+            << "Indexed declarations: " << report["declarations"] << "\n"
+            << "Unloaded:             " << report["unloaded_cells"] << " cells ("
+            << report["unloaded_transactions"] << " transactions), "
+            << mebibytes(report["freed_bytes"].get<std::size_t>()) << " freed\n";
+        publish_output("stdout", text.str());
 
+        nl::json kernel_res = ok_reply();
+        kernel_res["als_xeus_cling"]["memory"] = report;
         return kernel_res;
-       
     }
 
-    void interpreter::configure_impl()
+    void interpreter::answer_page_request(xeus::xcomm&& comm, const xeus::xmessage& request)
+    {
+        const nl::json& data = request.content()["data"];
+        nl::json reply;
+        try
+        {
+            const std::size_t pager_id = data.at("pager_id").get<std::size_t>();
+            const std::size_t start = data.at("start").get<std::size_t>();
+            // A page is never larger than what a summary shows.
+            const std::size_t count = std::min(data.at("count").get<std::size_t>(),
+                display_budget.max_elements);
+
+            std::vector<std::string> elements;
+            std::size_t size = 0;
+            if (pagers.page(pager_id, start, count, elements, size))
+            {
+                reply["pager_id"] = pager_id;
+                reply["start"] = start;
+                reply["size"] = size;
+                reply["elements"] = std::move(elements);
+            }
+            else
+            {
+                reply["error"] = "The object is no longer available.";
+            }
+        }
+        catch (const std::exception& e)
+        {
+            reply["error"] = e.what();
+        }
+
+        xeus::xcomm page_comm = std::move(comm);
+        page_comm.send(nl::json::object(), std::move(reply), {});
+        page_comm.close(nl::json::object(), nl::json::object(), {});
+    }
+
+    std::size_t interpreter::register_pager(std::size_t size,
+        pager_registry::page_function page)
     {
-        // Perform some operations
+        return pagers.add(size, std::move(page), display_budget.max_pagers);
     }
 
     nl::json interpreter::is_complete_request_impl(const std::string& code)
     {
-        // Copied from xeus-cling implementation.
+        drain_publications();
+
+        // Copied from xeus-cling implementation. The validator is local to the request,
+        // so that it can be served at any moment.
         nl::json kernel_res;
 
-        cling_input_validator.reset();
-        cling::InputValidator::ValidationResult res = cling_input_validator.validate(code);
+        cling::InputValidator input_validator;
+        cling::InputValidator::ValidationResult res = input_validator.validate(code);
         if (res == cling::InputValidator::kComplete)
         {
             kernel_res["status"] = "complete";
@@ -325,32 +2252,50 @@ namespace als::xeus_cling
     nl::json interpreter::complete_request_impl(const std::string&  code,
                                                      int cursor_pos)
     {
+        drain_publications();
+
         // Copied from xeus-cling implementation.
         std::vector<std::string> result;
-        cling::Interpreter::CompilationResult compilation_result;
         nl::json kernel_res;
 
         // split the input to have only the word in the back of the cursor
-        std::string delims = " \t\n`!@#$^&*()=+[{]}\\|;:\'\",<>?.";
+        const std::string_view delims = " \t\n`!@#$^&*()=+[{]}\\|;:\'\",<>?.";
         std::size_t _cursor_pos = cursor_pos;
-        std::vector<std::string> text = xcpp::split_line(code, delims, _cursor_pos);
-        std::string to_complete = text.back().c_str();
+        std::string_view to_complete = xcpp::split_line(code, delims, _cursor_pos).back();
+
+        // xeus dispatches the shell requests one after the other, so no cell is running
+        // (a completion requested meanwhile waits for the cell to finish), but the
+        // preloading of the kernel or a replay may be: we wait for them, since cling
+        // can not complete while it compiles.
+        std::unique_lock<std::mutex> compilation_lock(compilation_mutex);
 
-        compilation_result = cling_interpreter.codeComplete(code.c_str(), _cursor_pos, result);
+        // The cell without the word being completed. While it does not change and no
+        // cell declares anything new, typing more characters of the word only narrows
+        // the previous completions, so we do not need to ask cling again.
+        const std::size_t word_end = std::min(_cursor_pos, code.size());
+        const std::size_t word_start = word_end - std::min(word_end, to_complete.size());
+        const std::string context = code.substr(0, word_start) + '\0' + code.substr(word_end);
 
-        // change the print result
-        for (std::string& r : result)
+        if (!completions.lookup(declaration_generation, context, to_complete, result))
         {
-            // remove the definition at the beginning (for example [#int#])
-            r = std::regex_replace(r, std::regex("\\[\\#.*\\#\\]"), "");
-            // remove the variable name in <#type name#>
-            r = std::regex_replace(r, std::regex("(\\ |\\*)+(\\w+)(\\#\\>)"), "$1$3");
-            // remove unnecessary space at the end of <#type   #>
-            r = std::regex_replace(r, std::regex("\\ *(\\#\\>)"), "$1");
-            // remove <# #> to keep only the type
-            r = std::regex_replace(r, std::regex("\\<\\#([^#>]*)\\#\\>"), "$1");
+            cling_interpreter.codeComplete(code.c_str(), _cursor_pos, result);
+
+            // change the print result, e.g., [#int#]foo(<#int x#>) becomes foo(int)
+            for (std::string& r : result)
+            {
+                r = format_completion(r);
+            }
+            completions.store(declaration_generation, context, to_complete, result);
+            completions.lookup(declaration_generation, context, to_complete, result);
         }
 
+        result = rank_completions(std::move(result), code,
+            [this](std::string_view name)
+            {
+                return user_declarations.count(std::string(name)) != 0;
+            }, max_completions);
+        compilation_lock.unlock();
+
         kernel_res["matches"] = result;
         kernel_res["cursor_start"] = cursor_pos - to_complete.length();
         kernel_res["cursor_end"] = cursor_pos;
@@ -362,26 +2307,73 @@ namespace als::xeus_cling
     nl::json interpreter::inspect_request_impl(const std::string& code,
         int cursor_pos, int detail_level)
     {
-        // TODO. Seems complicated.
+        drain_publications();
 
         nl::json kernel_res;
-        kernel_res["plain/text"] = "Sorry. Code inspection is not yet implemented.";
+        kernel_res["status"] = "ok";
+        kernel_res["found"] = false;
+        kernel_res["data"] = nl::json::object();
+        kernel_res["metadata"] = nl::json::object();
+
+        const std::string name = identifier_at(code, cursor_pos);
+        if (name.empty())
+        {
+            return kernel_res;
+        }
+
+        // As for completion, we wait for the preloading or a replay to finish.
+        std::lock_guard<std::mutex> compilation_lock(compilation_mutex);
+
+        std::vector<const clang::NamedDecl*> declarations = find_declarations(name);
+        if (declarations.empty())
+        {
+            // The index does not know the names reached through namespace aliases or
+            // using directives, but clang does.
+            if (const clang::NamedDecl* declaration = lookup_declaration(cling_interpreter, name))
+            {
+                declarations.push_back(declaration);
+            }
+        }
+        if (declarations.empty())
+        {
+            return kernel_res;
+        }
+
+        // Overloaded functions have several declarations. We do not describe all the
+        // overloads of huge overload sets.
+        std::string description;
+        for (std::size_t i = 0; i < std::min(declarations.size(), max_inspected_declarations); ++i)
+        {
+            description += describe_declaration(declarations[i], detail_level) + "\n";
+        }
+        if (declarations.size() > max_inspected_declarations)
+        {
+            description += "... and " +
+                std::to_string(declarations.size() - max_inspected_declarations) +
+                " more declarations.\n";
+        }
+
+        kernel_res["found"] = true;
+        kernel_res["data"]["text/plain"] = description;
         return kernel_res;
     }
 
     void interpreter::shutdown_request_impl()
     {
+        drain_publications();
+        journal.close();
         std::cout << "Bye!!" << std::endl;
     }
 
     nl::json interpreter::kernel_info_request_impl()
     {
+        drain_publications();
 
         const std::string protocol_version = "5.3";
         const std::string implementation = "als-xeus-cling";
         const std::string implementation_version = ALS_XEUS_CLING_VERSION;
         const std::string language_name = "c++";
-        const std::string language_version = "c++17";
+        const std::string language_version = options.standard;
         const std::string language_mimetype = "text/x-c++src";
         const std::string language_file_extension = ".cpp";
         const std::string language_pygments_lexer = "";
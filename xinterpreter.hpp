@@ -1,12 +1,33 @@
 #ifndef ALS_XEUS_CLING_INTERPRETER_HPP
 #define ALS_XEUS_CLING_INTERPRETER_HPP
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "nlohmann/json.hpp"
 #include "als-xeus-cling-config.hpp"
+#include "xcompletion.hpp"
+#include "xinspection.hpp"
+#include "xjournal.hpp"
+#include "xmagics.hpp"
+#include "xoptions.hpp"
+#include "xpager.hpp"
+#include "xqueue.hpp"
+#include "xstream.hpp"
+#include "xworker.hpp"
+#include "xeus/xcomm.hpp"
 #include "xeus/xinterpreter.hpp"
 #include <cling/Interpreter/Interpreter.h>
 #include <cling/MetaProcessor/InputValidator.h>
+#include <cling/Interpreter/Transaction.h>
 #include <als-basic-utilities/ToString.hpp>
 
 
@@ -22,7 +43,12 @@ namespace als::xeus_cling
     {
         public:
 
-        interpreter();
+        /**
+         * @brief Construct a new interpreter.
+         * 
+         * @param kernel_options Options of the kernel (see parse_options).
+         */
+        explicit interpreter(const kernel_options& kernel_options = {});
         virtual ~interpreter() = default;
 
         /**
@@ -113,9 +139,496 @@ namespace als::xeus_cling
          */
         void shutdown_request_impl() override;
 
+        /**
+         * @brief Loads the libraries and includes the headers given in the options, the
+         * first time it is called. Run on cell_worker after configure_impl, unless a pool
+         * of kernels (see run_pool) has already called it before forking them.
+         * 
+         */
+        void preload();
+
+        /**
+         * @brief Journals the cells that declare something or contain preprocessor
+         * directives into path (see session_journal). If the kernel that used it before
+         * has crashed, its cells are replayed before the first cell; otherwise, they can
+         * be replayed with %replay. Must be called before the kernel starts.
+         * 
+         */
+        void open_journal(const std::string& path);
+
+        /**
+         * @brief Options the kernel has been started with.
+         * 
+         */
+        const kernel_options options;
+        /**
+         * @brief Command line arguments the cling interpreter has been created with.
+         * They must be declared before cling_interpreter, which is built from them.
+         * 
+         */
+        std::vector<std::string> interpreter_arguments;
+        /**
+         * @brief Publishes a Jupyter stream message. Unlike publish_stream, it can be
+         * called from any thread.
+         * 
+         * @param name Name of the stream ("stdout" or "stderr").
+         * @param text Text to be published.
+         */
+        void publish_output(const std::string& name, const std::string& text);
+
+        /**
+         * @brief Publishes a display_data message. Unlike display_data, it can be called
+         * from any thread.
+         * 
+         * @param data The data dict contains key/value pairs, where the keys are MIME types
+         * and the values are the raw data of the representation in that format.
+         * @param metadata Any metadata that describes the data.
+         * @param transient Information not to be persisted to a notebook or other documents.
+         */
+        void publish_display(nl::json data, nl::json metadata = nl::json::object(),
+            nl::json transient = nl::json::object());
+
+        /**
+         * @brief Publishes an update_display_data message, which replaces the contents
+         * of the display whose display_id is given in transient. It can be called from
+         * any thread.
+         * 
+         */
+        void publish_display_update(nl::json data, nl::json metadata, nl::json transient);
+
+        /**
+         * @brief Publishes a numeric array as a binary buffer, without formatting it.
+         * The buffer is sent in the comm_open message of a comm with the target
+         * "als.xeus_cling.array", whose data is a header describing the array. A
+         * display_data message with a short text/plain summary and the header, under
+         * the "application/vnd.als-xeus-cling.array+json" MIME type, refers to the comm
+         * so that frontend extensions can render the array. It can be called from any
+         * thread.
+         * 
+         * @param data The contiguous elements of the array, in row-major order.
+         * @param size Size of the elements in bytes.
+         * @param dtype Type of the elements, named as in numpy (e.g. "float64").
+         * @param shape Dimensions of the array.
+         * @param compress If true, the buffer is compressed with zlib when that makes
+         * it smaller.
+         */
+        void publish_array(const void* data, std::size_t size, const std::string& dtype,
+            const std::vector<std::size_t>& shape, bool compress);
+
+        /**
+         * @brief Keeps a summarized object so that the frontend can request the rest of
+         * its elements through a comm with the target "als.xeus_cling.pager". The comm
+         * is opened with the data {"pager_id", "start", "count"}, and the kernel answers
+         * with a message containing the formatted "elements" and the "size" of the
+         * object, and closes the comm.
+         * 
+         * @param size Number of elements of the object.
+         * @param page Function formatting a range of elements.
+         * @return std::size_t The id of the pager.
+         */
+        std::size_t register_pager(std::size_t size, pager_registry::page_function page);
+
+        /**
+         * @brief Returns a display_id that has not been used before.
+         * 
+         */
+        std::string new_display_id();
+
+        /**
+         * @brief Starts coalescing the displays published through publish_display (see
+         * display_batch in xdisplay.hpp). Consecutive displays with only a text/plain or
+         * only a text/latex representation are merged into one message, published when
+         * the batch ends, display_budget.batch_interval after the first of them or
+         * before anything else is published. Batches can be nested.
+         * 
+         */
+        void begin_display_batch();
+
+        /**
+         * @brief Ends the batch started by the last call to begin_display_batch.
+         * 
+         */
+        void end_display_batch();
+
+        /**
+         * @brief Function sending an IOPub message under the given parent header.
+         * 
+         */
+        using parented_publisher = std::function<void(const std::string& msg_type,
+            nl::json parent_header, nl::json metadata, nl::json content,
+            xeus::buffer_sequence buffers)>;
+
+        /**
+         * @brief Registers the function sending the streams and displays that the
+         * threads of a cell publish once the cell has finished. They are sent under the
+         * parent header of their cell (see publication), instead of that of the request
+         * being served when they are drained. Without it, they are sent as the other
+         * messages.
+         * 
+         */
+        void register_parented_publisher(parented_publisher publisher);
+
         cling::Interpreter cling_interpreter;
-        cling::InputValidator cling_input_validator;
         als::utilities::RepresentationType display_preferencies;
+
+        /**
+         * @brief Limits applied to the output written into std::cout and std::cerr by
+         * every cell.
+         * 
+         */
+        output_limits stream_limits;
+
+        /**
+         * @brief Limits applied to the representation of the objects displayed.
+         * 
+         */
+        display_limits display_budget;
+
+        /**
+         * @brief While the result of a cell is displayed, points to it and keeps its
+         * storage alive, so that a summarized result can be paged without being copied.
+         * Empty otherwise.
+         * 
+         */
+        std::shared_ptr<const void> displayed_result;
+
+        /**
+         * @brief Magic commands, run instead of the cells starting with a percent sign.
+         * The kernel provides %time (or %%time), which executes the cell and prints the
+         * duration of every phase, and %timeit (or %%timeit), which measures the time
+         * taken by a statement (or the body of the cell), as well as %optimize and
+         * %replay (see optimize_magic and replay_magic).
+         * 
+         */
+        magic_registry magics;
+
+        /**
+         * @brief Maximum number of matches sent in reply to a completion request.
+         * 
+         */
+        std::size_t max_completions;
+
+        private:
+
+        /**
+         * @brief Receives the events of cling_interpreter.
+         * 
+         */
+        class callbacks;
+
+        /**
+         * @brief Executes a cell. Called by execute_request_impl from cell_worker.
+         * See execute_request_impl for the meaning of the parameters. If report_timing
+         * is true, the duration of every phase is published after the output.
+         * 
+         */
+        nl::json execute_cell(int execution_counter, const std::string& code,
+            bool silent, bool store_history, nl::json user_expressions,
+            bool allow_stdin, bool report_timing);
+
+        /**
+         * @brief Returns the content of a successful execute_reply.
+         * 
+         */
+        nl::json ok_reply() const;
+
+        /**
+         * @brief Publishes an error and returns the content of the execute_reply.
+         * 
+         */
+        nl::json error_reply(const std::string& name, const std::string& value);
+
+        /**
+         * @brief Implements %optimize, which shows or sets the optimization level of the
+         * JIT, for the rest of the session (%optimize N) or only for the body of the
+         * cell (%%optimize N).
+         * 
+         */
+        nl::json optimize_magic(const magic_command& command, int execution_counter);
+
+        /**
+         * @brief The optimization settings of the JIT, added to every execute_reply so
+         * that benchmarks can be reproduced.
+         * 
+         */
+        nl::json optimization_settings() const;
+
+        /**
+         * @brief Implements %timeit. The statement is compiled once into a function,
+         * which is then called as many times as needed, so that the measure does not
+         * include the interpreter.
+         * 
+         */
+        nl::json timeit_magic(const magic_command& command, int execution_counter);
+
+        /**
+         * @brief Replays cells of a previous session on cell_worker, as fast as possible:
+         * consecutive cells that only declare are compiled as one transaction, and
+         * nothing they write or display is published. The cells that succeed are
+         * journaled again.
+         * 
+         * @return std::size_t The number of cells that failed.
+         */
+        std::size_t replay(const std::vector<journaled_cell>& cells);
+
+        /**
+         * @brief Implements %replay, which replays the journal of the previous kernel.
+         * 
+         */
+        nl::json replay_magic(const magic_command& command, int execution_counter);
+
+        session_journal journal;
+        // Set while replaying, to drop what the cells publish.
+        std::atomic<bool> replaying{false};
+
+        /**
+         * @brief Called by cling_interpreter every time a transaction has been compiled.
+         * 
+         * @param transaction The transaction.
+         */
+        void transaction_committed(const cling::Transaction& transaction);
+
+        /**
+         * @brief Compiled function that writes into result (an nl::json*) the mime
+         * representation of the object of a given type pointed by object.
+         * 
+         */
+        using display_thunk = void (*)(void* object, void* result);
+
+        /**
+         * @brief Returns the display thunk of the given type, compiling it the first
+         * time the type is seen. Returns nullptr if it can not be compiled.
+         * 
+         * @param type The type of the object as written in C++ source code.
+         * @return display_thunk 
+         */
+        display_thunk get_display_thunk(const std::string& type);
+
+        std::unordered_map<std::string, display_thunk> display_thunks;
+        // Number of functions compiled by %timeit, used to name them.
+        std::size_t timeit_counter = 0;
+
+        /**
+         * @brief Publishes the displays coalesced so far. Only called by the shell
+         * thread.
+         * 
+         */
+        void flush_display_batch();
+
+        /**
+         * @brief Ends every batch left open by the cell, e.g. because it was interrupted.
+         * 
+         */
+        void close_display_batches();
+
+        pager_registry pagers;
+        // Set by preload, under compilation_mutex.
+        bool preloaded = false;
+        // Set by configure_impl, once the interpreter belongs to a kernel: until then,
+        // it has no comms.
+        bool configured = false;
+
+        /**
+         * @brief Answers a request for the elements of a summarized object (see
+         * register_pager), received on the shell thread.
+         * 
+         */
+        void answer_page_request(xeus::xcomm&& comm, const xeus::xmessage& request);
+
+        /**
+         * @brief Queues a message to be published by the shell thread. It can be called
+         * from any thread, without waiting.
+         * 
+         * @param message Function sending the message through xeus.
+         */
+        void publish(std::function<void()> message);
+
+        /**
+         * @brief Sends the queued messages, in order. Called by the shell thread while it
+         * waits for a cell, and whenever it receives a request, so that what the threads
+         * started by a previous cell publish is not kept. The messages queued after their
+         * cell has finished are sent under its parent header (see
+         * register_parented_publisher).
+         * 
+         */
+        void drain_publications();
+
+        /**
+         * @brief Sends a stream, display_data or update_display_data message, under the
+         * parent header of the late message being drained if there is one.
+         * 
+         */
+        void send_stream(const std::string& name, const std::string& text);
+        void send_display(const std::string& msg_type, nl::json data, nl::json metadata,
+            nl::json transient);
+
+        /**
+         * @brief Returns the cell a message published by the calling thread belongs to
+         * (see publication).
+         * 
+         */
+        std::size_t publishing_cell() const;
+
+        // A message queued by publish, with the cell it belongs to: the cell being
+        // executed if it is published by the thread of the cells, and otherwise the one
+        // during which the thread has published for the first time, i.e. the cell that
+        // has started it unless the thread has kept silent until a later cell.
+        struct publication
+        {
+            std::size_t cell;
+            std::function<void()> send;
+        };
+
+        // Messages published by the cell, the threads it has started and the readers of
+        // the captured file descriptors. Only the shell thread sends them, since the
+        // sockets of xeus can not be shared between threads.
+        mpsc_queue<publication> publications;
+        // Number of cells started, and the one being executed (0 between cells). The
+        // parent headers of the last max_parented_cells cells are kept for their late
+        // messages; those of older cells are sent as the other messages. Only used by
+        // the shell thread, except started_cells.
+        std::atomic<std::size_t> started_cells{0};
+        std::size_t active_cell = 0;
+        std::unordered_map<std::size_t, nl::json> cell_parents;
+        // Parent header of the late message being sent, if any. Only used by the shell
+        // thread.
+        const nl::json* late_parent = nullptr;
+        parented_publisher late_publisher;
+        // Displays being coalesced, all of them with the same MIME type. Only used by
+        // the shell thread.
+        std::size_t display_batch_depth = 0;
+        std::string batched_mime_type;
+        std::vector<std::string> batched_displays;
+        std::size_t batched_bytes = 0;
+        // When the batch is published at the latest, set from the batch_interval of the
+        // display that has started it.
+        std::chrono::steady_clock::time_point batch_deadline;
+        std::atomic<std::size_t> display_id_counter{0};
+
+        // Thread on which cells are executed and interrupted.
+        worker cell_worker;
+
+        // Held while cling_interpreter is used: by the cells, the magics and the
+        // completion and inspection requests, on the shell thread or the worker, and
+        // by the preloading and the replays posted to the worker in the background.
+        std::mutex compilation_mutex;
+        // When the code of the running cell started to run, once it has. Set by
+        // transaction_committed.
+        std::optional<std::chrono::steady_clock::time_point> execution_start_time;
+
+        // Incremented every time a transaction declares something. Protected, as the
+        // members below, by compilation_mutex.
+        std::size_t declaration_generation = 0;
+        // Names declared in the cells.
+        std::set<std::string> user_declarations;
+        completion_cache completions;
+        // Every declaration, for inspection requests. Those of the cells are indexed as
+        // they are committed; the others (the prelude, the standard library, what is
+        // preloaded...) only wait in unindexed_declarations until a lookup misses, so
+        // that they do not slow the startup down.
+        symbol_index symbols;
+        std::unordered_set<const clang::Decl*> unindexed_declarations;
+
+        /**
+         * @brief Finds the declarations of a name in symbols, indexing the pending
+         * declarations first if none is found.
+         *
+         */
+        std::vector<const clang::NamedDecl*> find_declarations(const std::string& name);
+
+        /**
+         * @brief A cell that has run without declaring anything, which can be run
+         * again without being compiled again.
+         *
+         */
+        struct compiled_cell
+        {
+            // The value of declaration_generation and the optimization level when it
+            // was compiled. It is only reused while they have not changed.
+            std::size_t generation;
+            int optimization_level;
+            // The function cling has wrapped the cell into. Its argument is the
+            // cling::Value receiving the value of the last expression.
+            void (*wrapper)(void*);
+        };
+
+        // Compiled cells, by code. Protected by compilation_mutex.
+        std::unordered_map<std::string, compiled_cell> compiled_cells;
+        // Wrapper of the last cell committed by cling, set by transaction_committed.
+        const clang::FunctionDecl* committed_wrapper = nullptr;
+
+        /**
+         * @brief What an executed cell has compiled, so that it can be unloaded.
+         *
+         */
+        struct executed_cell
+        {
+            std::string code;
+            // The last transaction before the cell. Unloading the cell unloads every
+            // transaction after it.
+            const cling::Transaction* previous_transaction;
+            // The first pager the cell may have added.
+            std::size_t first_pager;
+            std::size_t transactions = 0;
+            std::vector<const clang::Decl*> declarations{};
+            std::vector<std::string> display_thunk_types{};
+            bool declares = false;
+            bool journaled = false;
+        };
+
+        /**
+         * @brief Returns the index in cell_history of the last cell that has declared
+         * something, if any.
+         *
+         */
+        std::optional<std::size_t> last_declaring_cell() const;
+
+        /**
+         * @brief Unloads the cells of cell_history from first on, removes what they have
+         * declared from the indexes of the kernel and returns the memory freed to the
+         * system. Called with compilation_mutex held.
+         *
+         * @return std::vector<executed_cell> The cells unloaded, from the oldest.
+         */
+        std::vector<executed_cell> unload_cells(std::size_t first);
+
+        /**
+         * @brief Forgets cell_history, when code that does not belong to a cell is about
+         * to be compiled: unloading the cells would also unload it.
+         *
+         */
+        void forget_cell_history();
+
+        /**
+         * @brief Implements %unload, which unloads the last cell that has declared
+         * something and the cells after it, and %reset, which unloads every cell.
+         *
+         */
+        nl::json unload_magic(const magic_command& command, int execution_counter);
+
+        /**
+         * @brief Implements %memory, which reports the memory used by the session and
+         * what unloading cells has freed.
+         *
+         */
+        nl::json memory_magic(const magic_command& command, int execution_counter);
+
+        /**
+         * @brief The memory report of %memory, also added to its execute_reply.
+         *
+         */
+        nl::json memory_report() const;
+
+        // Cells that can be unloaded, from the oldest. Protected by compilation_mutex,
+        // as the members below.
+        std::vector<executed_cell> cell_history;
+        // Set while a cell is executed: the transactions committed meanwhile belong to
+        // the last element of cell_history.
+        bool tracking_cell = false;
+        // What has been unloaded since the start of the session.
+        std::size_t unloaded_cells = 0;
+        std::size_t unloaded_transactions = 0;
+        std::size_t freed_bytes = 0;
     };
 }
 
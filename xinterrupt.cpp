@@ -0,0 +1,296 @@
+#include <atomic>
+#include <csetjmp>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "xinterrupt.hpp"
+
+namespace
+{
+    // Everything touched by the signal handler is either a lock-free atomic or written
+    // before the handler can use it.
+    sigjmp_buf jump_buffer;
+    pthread_t target_thread;
+    std::atomic<bool> has_target{false};
+    // Inside run_interruptible.
+    std::atomic<bool> running{false};
+    // The code of the cell has been compiled and is running.
+    std::atomic<bool> executing{false};
+    // An interruption has been requested and not delivered yet.
+    std::atomic<bool> interrupted{false};
+    // Number of interruptions requested since run_interruptible was called.
+    std::atomic<int> requests{0};
+    // Number of interrupt_guards alive in the target thread.
+    std::atomic<int> deferring{0};
+    static_assert(std::atomic<bool>::is_always_lock_free &&
+        std::atomic<int>::is_always_lock_free);
+
+    // Value sent with the SIGINTs of retry_interrupt, which are not new requests.
+    constexpr int retry_value = 0x1e7;
+
+    // Code of the loaded objects (the kernel, cling, the C and C++ libraries, the
+    // libraries loaded by the cells...). The code compiled from the cells is not part
+    // of any of them. Written by execution_started, in the target thread, while the
+    // handler can not read it.
+    struct code_range
+    {
+        std::uintptr_t begin;
+        std::uintptr_t end;
+        // Code of the kernel or of cling, which is never jumped out of.
+        bool protected_code;
+    };
+    constexpr std::size_t max_code_ranges = 4096;
+    code_range code_ranges[max_code_ranges];
+    std::size_t code_range_count = 0;
+    std::atomic<bool> code_ranges_ready{false};
+    // Base address of the kernel.
+    std::uintptr_t kernel_base = 0;
+
+    // Tells whether the file name of a loaded object is that of cling or of the
+    // libraries it is made of.
+    bool is_compiler_library(const char* name)
+    {
+        const char* base_name = std::strrchr(name, '/');
+        base_name = (base_name != nullptr) ? base_name + 1 : name;
+        for (const char* prefix : {"libcling", "libclang", "libLLVM"})
+        {
+            if (std::strncmp(base_name, prefix, std::strlen(prefix)) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int add_code_ranges(dl_phdr_info* info, std::size_t, void*)
+    {
+        const bool protected_code = info->dlpi_addr == kernel_base ||
+            is_compiler_library(info->dlpi_name);
+        for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i)
+        {
+            const ElfW(Phdr)& header = info->dlpi_phdr[i];
+            if (header.p_type != PT_LOAD || !(header.p_flags & PF_X))
+            {
+                continue;
+            }
+            if (code_range_count == max_code_ranges)
+            {
+                return 1;
+            }
+            const std::uintptr_t begin = info->dlpi_addr + header.p_vaddr;
+            code_ranges[code_range_count++] = {begin, begin + header.p_memsz, protected_code};
+        }
+        return 0;
+    }
+
+    // Returns the address of the instruction the target thread was interrupted at, or 0
+    // if it is unknown on this architecture.
+    std::uintptr_t program_counter(const void* context)
+    {
+        const ucontext_t* user_context = static_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+        return user_context->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+        return user_context->uc_mcontext.pc;
+#else
+        static_cast<void>(user_context);
+        return 0;
+#endif
+    }
+
+    // Where the target thread has been interrupted.
+    enum class interrupted_code
+    {
+        // Code compiled from a cell, which can be jumped out of.
+        cell,
+        // A library, which is only jumped out of when the interruption is forced.
+        library,
+        // The kernel or cling, which are never jumped out of.
+        kernel
+    };
+
+    interrupted_code classify(const void* context)
+    {
+        const std::uintptr_t pc = program_counter(context);
+        if (pc == 0 || !code_ranges_ready)
+        {
+            return interrupted_code::library;
+        }
+        for (std::size_t i = 0; i < code_range_count; ++i)
+        {
+            if (pc >= code_ranges[i].begin && pc < code_ranges[i].end)
+            {
+                return code_ranges[i].protected_code ? interrupted_code::kernel :
+                    interrupted_code::library;
+            }
+        }
+        return interrupted_code::cell;
+    }
+
+    void interrupt_handler(int signal, siginfo_t* info, void* context)
+    {
+        if (has_target && !pthread_equal(pthread_self(), target_thread))
+        {
+            pthread_kill(target_thread, signal);
+            return;
+        }
+
+        if (!running)
+        {
+            return;
+        }
+
+        const bool retry = info->si_code == SI_QUEUE && info->si_pid == getpid() &&
+            info->si_value.sival_int == retry_value;
+        if (!retry)
+        {
+            interrupted = true;
+            ++requests;
+        }
+        else if (!interrupted)
+        {
+            return;
+        }
+
+        // Jumping out of the compiler, of the kernel while it holds a lock, or of a
+        // library (e.g. from inside malloc) would leave them in an inconsistent state,
+        // so the interruption stays pending and retry_interrupt delivers it later.
+        // A second request forces it out of libraries, where the cell may be blocked.
+        if (!executing || deferring > 0)
+        {
+            return;
+        }
+        const interrupted_code code = classify(context);
+        if (code == interrupted_code::cell || (code == interrupted_code::library &&
+            requests > 1))
+        {
+            executing = false;
+            interrupted = false;
+            siglongjmp(jump_buffer, 1);
+        }
+    }
+
+    // Tells the handler that no cell runs any more, however run_interruptible is left,
+    // so that it never jumps into a frame which has returned.
+    void stop_running()
+    {
+        running = false;
+        executing = false;
+        interrupted = false;
+    }
+
+    sigset_t interrupt_mask()
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        return mask;
+    }
+}
+
+namespace als::xeus_cling
+{
+    void install_interrupt_handler()
+    {
+        Dl_info kernel;
+        if (dladdr(reinterpret_cast<void*>(&interrupt_handler), &kernel) != 0)
+        {
+            kernel_base = reinterpret_cast<std::uintptr_t>(kernel.dli_fbase);
+        }
+
+        struct sigaction action = {};
+        action.sa_sigaction = interrupt_handler;
+        action.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+
+        sigset_t mask = interrupt_mask();
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    }
+
+    void accept_interrupts()
+    {
+        target_thread = pthread_self();
+        has_target = true;
+
+        sigset_t mask = interrupt_mask();
+        pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+    }
+
+    bool run_interruptible(const std::function<void()>& function)
+    {
+        interrupted = false;
+        requests = 0;
+        executing = false;
+        if (sigsetjmp(jump_buffer, 1) != 0)
+        {
+            stop_running();
+            return false;
+        }
+
+        // No destructor may run between the jump and sigsetjmp, hence no RAII guard.
+        running = true;
+        try
+        {
+            function();
+        }
+        catch (...)
+        {
+            stop_running();
+            throw;
+        }
+        stop_running();
+        return true;
+    }
+
+    void execution_started()
+    {
+        if (!running)
+        {
+            return;
+        }
+
+        // The libraries loaded while compiling the cell are taken into account.
+        code_ranges_ready = false;
+        code_range_count = 0;
+        if (dl_iterate_phdr(add_code_ranges, nullptr) == 0)
+        {
+            code_ranges_ready = true;
+        }
+        executing = true;
+    }
+
+    void retry_interrupt()
+    {
+        if (has_target && running && executing && interrupted)
+        {
+            sigval value;
+            value.sival_int = retry_value;
+            pthread_sigqueue(target_thread, SIGINT, value);
+        }
+    }
+
+    interrupt_guard::interrupt_guard():
+        m_deferring{has_target && pthread_equal(pthread_self(), target_thread)}
+    {
+        if (m_deferring)
+        {
+            ++deferring;
+        }
+    }
+
+    interrupt_guard::~interrupt_guard()
+    {
+        if (m_deferring)
+        {
+            --deferring;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef ALS_XEUS_CLING_XINTERRUPT_HPP
+#define ALS_XEUS_CLING_XINTERRUPT_HPP
+
+#include <functional>
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Installs the SIGINT handler that interrupts the code of the cells, and blocks
+     * SIGINT in the calling thread, so that every thread created afterwards (in particular,
+     * the threads of the server) is not disturbed by it. Must be called from main before
+     * any other thread is created.
+     *
+     */
+    void install_interrupt_handler();
+
+    /**
+     * @brief Makes the calling thread the one that receives the interruptions. SIGINT
+     * received by any other thread is forwarded to it.
+     *
+     */
+    void accept_interrupts();
+
+    /**
+     * @brief Calls function so that it can be interrupted by SIGINT once the code of the
+     * cell starts running (see execution_started).
+     *
+     * The thread only jumps out of function when it is interrupted in the code compiled
+     * from the cell. Interruptions received elsewhere (while cling compiles, in the kernel,
+     * or in a library such as the C library, which may be inside malloc or hold a lock)
+     * stay pending until retry_interrupt finds it in the code of the cell. A second
+     * interruption also jumps out of libraries, so that a cell blocked in a system call
+     * can be interrupted; it may leave them in an inconsistent state. Nothing ever jumps
+     * out of the kernel or cling, nor while an interrupt_guard is alive.
+     *
+     * Interrupting skips the destructors of the objects living in the interrupted frames,
+     * so the locks held by the cell stay held.
+     *
+     * @param function Function to be called. It must be called from the thread that
+     * accepts interrupts.
+     * @return true if function returned normally.
+     * @return false if it was interrupted.
+     */
+    bool run_interruptible(const std::function<void()>& function);
+
+    /**
+     * @brief Tells that cling has finished compiling and the code of the cell is about
+     * to run, so it can be interrupted from now on. It never interrupts by itself, so it
+     * can be called from the callbacks of cling.
+     *
+     */
+    void execution_started();
+
+    /**
+     * @brief Sends SIGINT again to the thread that accepts interrupts if an interruption
+     * is still pending while the code of the cell runs. Called periodically by another
+     * thread.
+     *
+     */
+    void retry_interrupt();
+
+    /**
+     * @brief Delays interruptions received by the thread that accepts interrupts while
+     * it is alive. Used by the kernel code that can be called from the cells and holds
+     * locks. It costs an atomic increment.
+     *
+     */
+    class interrupt_guard
+    {
+        public:
+
+        interrupt_guard();
+        interrupt_guard(const interrupt_guard&) = delete;
+        interrupt_guard& operator=(const interrupt_guard&) = delete;
+        ~interrupt_guard();
+
+        private:
+
+        // The guard has been created by the thread that accepts interrupts.
+        bool m_deferring;
+    };
+}
+
+#endif // ALS_XEUS_CLING_XINTERRUPT_HPP
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "xjournal.hpp"
+
+namespace nl = nlohmann;
+
+namespace als::xeus_cling
+{
+    bool session_journal::open(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_previous_cells.clear();
+        m_previous_crashed = false;
+        m_previous_crashed_replaying = false;
+        m_previous_crashed_code.reset();
+
+        std::ifstream previous(path);
+        std::string line;
+        bool shut_down = false;
+        // The cell and the replay that had not completed when the journal ended.
+        std::optional<std::string> running;
+        std::size_t cells_before_running = 0;
+        std::optional<std::vector<journaled_cell>> replay;
+        std::size_t cells_before_replay = 0;
+        std::optional<std::pair<std::size_t, std::size_t>> replaying;
+        while (std::getline(previous, line))
+        {
+            // The last line may have been cut by a crash.
+            const nl::json record = nl::json::parse(line, nullptr, false);
+            if (record.is_discarded())
+            {
+                break;
+            }
+            shut_down = record.contains("shutdown");
+            if (record.contains("cell"))
+            {
+                m_previous_cells.push_back({record["cell"].get<std::string>(),
+                    record.value("statements", true)});
+            }
+            else if (record.contains("undo"))
+            {
+                if (!m_previous_cells.empty())
+                {
+                    m_previous_cells.pop_back();
+                }
+            }
+            else if (record.contains("running"))
+            {
+                running = record["running"].get<std::string>();
+                cells_before_running = m_previous_cells.size();
+            }
+            else if (record.contains("completed"))
+            {
+                running.reset();
+            }
+            else if (record.contains("replay"))
+            {
+                replay.emplace();
+                for (const nl::json& cell : record["replay"])
+                {
+                    replay->push_back({cell["cell"].get<std::string>(),
+                        cell.value("statements", true)});
+                }
+                cells_before_replay = m_previous_cells.size();
+                replaying.reset();
+            }
+            else if (record.contains("replaying"))
+            {
+                replaying.emplace(record["replaying"][0].get<std::size_t>(),
+                    record["replaying"][1].get<std::size_t>());
+            }
+            else if (record.contains("replayed"))
+            {
+                replay.reset();
+            }
+        }
+        previous.close();
+
+        if (replay && replaying)
+        {
+            // The kernel crashed during the replay: the cells it has appended since are
+            // the ones it had replayed. The ones it was replaying are left out.
+            m_previous_cells.resize(std::min(m_previous_cells.size(),
+                cells_before_replay));
+            std::string crashed_code;
+            for (std::size_t i = 0; i < replay->size(); ++i)
+            {
+                if (i >= replaying->first && i < replaying->first + replaying->second)
+                {
+                    crashed_code += (*replay)[i].code + "\n";
+                }
+                else
+                {
+                    m_previous_cells.push_back((*replay)[i]);
+                }
+            }
+            m_previous_crashed_code = crashed_code;
+        }
+        else
+        {
+            // What the cell that had not completed has appended is left out.
+            if (running && !shut_down)
+            {
+                m_previous_cells.resize(std::min(m_previous_cells.size(),
+                    cells_before_running));
+                m_previous_crashed_code = running;
+            }
+            // The cells of a replay that has not started (see below) come before the
+            // ones appended since.
+            if (replay)
+            {
+                const std::size_t position = std::min(m_previous_cells.size(),
+                    cells_before_replay);
+                m_previous_cells.insert(m_previous_cells.begin() + position,
+                    replay->begin(), replay->end());
+            }
+        }
+        m_previous_crashed = !m_previous_cells.empty() && !shut_down;
+        m_previous_crashed_replaying = m_previous_crashed && replay.has_value();
+
+        m_file.close();
+        m_file.open(path, std::ios::trunc);
+        // The cells that are not replayed automatically are kept, as a replay that has
+        // not started, until they are replayed.
+        if (m_file && m_previous_crashed_replaying)
+        {
+            write_replay(m_previous_cells);
+        }
+        return m_file.is_open();
+    }
+
+    bool session_journal::is_open() const
+    {
+        return m_file.is_open();
+    }
+
+    void session_journal::append(const std::string& cell, bool statements)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file)
+        {
+            return;
+        }
+        m_file << nl::json{{"cell", cell}, {"statements", statements}}.dump() << "\n";
+        m_file.flush();
+    }
+
+    void session_journal::begin_cell(const std::string& cell)
+    {
+        write(nl::json{{"running", cell}}.dump());
+    }
+
+    void session_journal::end_cell()
+    {
+        write(nl::json{{"completed", true}}.dump());
+    }
+
+    void session_journal::begin_replay(const std::vector<journaled_cell>& cells)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file)
+        {
+            return;
+        }
+        write_replay(cells);
+    }
+
+    void session_journal::replaying(std::size_t first, std::size_t count)
+    {
+        write(nl::json{{"replaying", {first, count}}}.dump());
+    }
+
+    void session_journal::end_replay()
+    {
+        write(nl::json{{"replayed", true}}.dump());
+    }
+
+    void session_journal::undo()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file)
+        {
+            return;
+        }
+        m_file << nl::json{{"undo", true}}.dump() << "\n";
+        m_file.flush();
+    }
+
+    void session_journal::write(const std::string& record)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file)
+        {
+            return;
+        }
+        m_file << record << "\n";
+        m_file.flush();
+    }
+
+    void session_journal::write_replay(const std::vector<journaled_cell>& cells)
+    {
+        nl::json record = {{"replay", nl::json::array()}};
+        for (const journaled_cell& cell : cells)
+        {
+            record["replay"].push_back({{"cell", cell.code},
+                {"statements", cell.statements}});
+        }
+        m_file << record.dump() << "\n";
+        m_file.flush();
+    }
+
+    void session_journal::close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file)
+        {
+            return;
+        }
+        m_file << nl::json{{"shutdown", true}}.dump() << "\n";
+        m_file.close();
+    }
+
+    bool session_journal::previous_crashed() const
+    {
+        return m_previous_crashed;
+    }
+
+    bool session_journal::previous_crashed_replaying() const
+    {
+        return m_previous_crashed_replaying;
+    }
+
+    const std::optional<std::string>& session_journal::previous_crashed_code() const
+    {
+        return m_previous_crashed_code;
+    }
+
+    std::vector<journaled_cell> session_journal::take_previous_cells()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_previous_crashed = false;
+        m_previous_crashed_replaying = false;
+        m_previous_crashed_code.reset();
+        return std::exchange(m_previous_cells, {});
+    }
+}
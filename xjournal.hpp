@@ -0,0 +1,156 @@
+#ifndef ALS_XEUS_CLING_XJOURNAL_HPP
+#define ALS_XEUS_CLING_XJOURNAL_HPP
+
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief A cell read from a journal.
+     *
+     */
+    struct journaled_cell
+    {
+        std::string code;
+
+        /**
+         * @brief Whether cling has wrapped statements of the cell into a function run
+         * after it has been compiled, as opposed to a cell that only declares. Cells
+         * journaled before this was recorded are assumed to have statements.
+         *
+         */
+        bool statements = true;
+    };
+
+    /**
+     * @brief Journal of the cells that have changed the state of the interpreter, so
+     * that a session can be recovered by replaying them in a new kernel.
+     *
+     * The journal is a file with one JSON record per line: {"cell": code, "statements":
+     * true or false} for every cell, appended as soon as it has succeeded,
+     * {"undo": true} when the last cell has been unloaded, and {"shutdown": true} when
+     * the kernel shuts down. A journal without the last record has been left by a
+     * kernel that crashed or was killed.
+     *
+     * So that a crash does not turn into a restart loop, every execution is framed by
+     * {"running": code} and {"completed": true}, and every replay by {"replay": cells},
+     * {"replaying": [first, count]} before each group of cells, and {"replayed": true}.
+     * The cell that was running when the kernel stopped is not replayed, and neither
+     * is anything after a crash during a replay: its cells are kept for %replay, except
+     * the ones that were being replayed.
+     *
+     */
+    class session_journal
+    {
+        public:
+
+        /**
+         * @brief Reads the journal left at path by the previous kernel, if any, and
+         * starts a new one (truncating it) there.
+         *
+         * @return false if the journal could not be created.
+         */
+        bool open(const std::string& path);
+
+        bool is_open() const;
+
+        /**
+         * @brief Appends a cell. It can be called from any thread.
+         *
+         * @param cell Code of the cell.
+         * @param statements Whether the cell has statements (see journaled_cell).
+         */
+        void append(const std::string& cell, bool statements);
+
+        /**
+         * @brief Records that a cell starts running, before anything is appended by it.
+         *
+         */
+        void begin_cell(const std::string& cell);
+
+        /**
+         * @brief Records that the cell started by begin_cell has completed.
+         *
+         */
+        void end_cell();
+
+        /**
+         * @brief Records that cells are about to be replayed. The cells that succeed are
+         * appended while they are replayed.
+         *
+         */
+        void begin_replay(const std::vector<journaled_cell>& cells);
+
+        /**
+         * @brief Records that count cells, from first, of those given to begin_replay
+         * are being replayed.
+         *
+         */
+        void replaying(std::size_t first, std::size_t count);
+
+        /**
+         * @brief Records that the replay started by begin_replay has completed.
+         *
+         */
+        void end_replay();
+
+        /**
+         * @brief Removes the last cell appended, which has been unloaded.
+         *
+         */
+        void undo();
+
+        /**
+         * @brief Writes the last record and closes the journal.
+         *
+         */
+        void close();
+
+        /**
+         * @brief Whether the previous kernel ended without shutting down.
+         *
+         */
+        bool previous_crashed() const;
+
+        /**
+         * @brief Whether the previous kernel crashed while it was replaying cells. Its
+         * cells should then not be replayed without being asked to.
+         *
+         */
+        bool previous_crashed_replaying() const;
+
+        /**
+         * @brief The code that was running when the previous kernel crashed, if known.
+         * It is not among the previous cells.
+         *
+         */
+        const std::optional<std::string>& previous_crashed_code() const;
+
+        /**
+         * @brief Returns the cells of the previous journal, and forgets them and how
+         * the previous kernel ended, so that they are replayed at most once.
+         *
+         */
+        std::vector<journaled_cell> take_previous_cells();
+
+        private:
+
+        // Writes a record, taking the lock.
+        void write(const std::string& record);
+        // Writes a replay record, the lock being held.
+        void write_replay(const std::vector<journaled_cell>& cells);
+
+        std::mutex m_mutex;
+        std::ofstream m_file;
+        std::vector<journaled_cell> m_previous_cells;
+        bool m_previous_crashed = false;
+        bool m_previous_crashed_replaying = false;
+        std::optional<std::string> m_previous_crashed_code;
+    };
+}
+
+#endif // ALS_XEUS_CLING_XJOURNAL_HPP
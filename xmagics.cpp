@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "xmagics.hpp"
+#include "xtiming.hpp"
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    std::uint64_t cycle_counter()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    struct run_result
+    {
+        double seconds;
+        std::uint64_t cycles;
+    };
+
+    run_result run(void (*function)(), std::size_t loops)
+    {
+        const clock::time_point start = clock::now();
+        const std::uint64_t start_cycles = cycle_counter();
+        for (std::size_t i = 0; i < loops; ++i)
+        {
+            function();
+        }
+        const std::uint64_t end_cycles = cycle_counter();
+        const clock::time_point end = clock::now();
+        return {std::chrono::duration<double>(end - start).count(), end_cycles - start_cycles};
+    }
+
+    // Formats a count with thousands separators, e.g. 100,000.
+    std::string format_count(std::size_t count)
+    {
+        std::string digits = std::to_string(count);
+        for (std::size_t i = digits.size(); i > 3; i -= 3)
+        {
+            digits.insert(i - 3, ",");
+        }
+        return digits;
+    }
+}
+
+namespace als::xeus_cling
+{
+    std::optional<magic_command> parse_magic(std::string_view code)
+    {
+        if (code.empty() || code.front() != '%')
+        {
+            return std::nullopt;
+        }
+
+        magic_command command;
+        command.is_cell_magic = code.substr(0, 2) == "%%";
+        const std::size_t line_end = code.find('\n');
+        std::string_view first_line = code.substr(command.is_cell_magic ? 2 : 1,
+            line_end == std::string_view::npos ? std::string_view::npos :
+            line_end - (command.is_cell_magic ? 2 : 1));
+        if (line_end != std::string_view::npos)
+        {
+            command.body = code.substr(line_end + 1);
+        }
+
+        const std::size_t name_end = std::min(first_line.find_first_of(" \t"),
+            first_line.size());
+        command.name = first_line.substr(0, name_end);
+        const std::size_t arguments_start = first_line.find_first_not_of(" \t", name_end);
+        if (arguments_start != std::string_view::npos)
+        {
+            command.arguments = first_line.substr(arguments_start);
+        }
+        return command;
+    }
+
+    void magic_registry::add(const std::string& name, handler magic)
+    {
+        m_handlers[name] = std::move(magic);
+    }
+
+    const magic_registry::handler* magic_registry::find(const std::string& name) const
+    {
+        auto found = m_handlers.find(name);
+        return (found == m_handlers.end()) ? nullptr : &found->second;
+    }
+
+    nl::json timeit_result::to_json() const
+    {
+        nl::json res;
+        res["loops"] = loops;
+        res["runs"] = runs;
+        res["min"] = min;
+        res["median"] = median;
+        res["mean"] = mean;
+        res["stddev"] = stddev;
+        if (cycles > 0)
+        {
+            res["cycles"] = cycles;
+        }
+        return res;
+    }
+
+    std::string timeit_result::report() const
+    {
+        std::string res = format_duration(mean) + " ± " + format_duration(stddev) +
+            " per loop (mean ± std. dev. of " + format_count(runs) +
+            (runs == 1 ? " run, " : " runs, ") + format_count(loops) +
+            (loops == 1 ? " loop each)" : " loops each)");
+        res += "\nmin: " + format_duration(min) + ", median: " + format_duration(median);
+        if (cycles > 0)
+        {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.4g", cycles);
+            res += std::string(", ") + buffer + " cycles per loop";
+        }
+        return res + "\n";
+    }
+
+    timeit_result timeit(void (*function)(), std::chrono::duration<double> min_run_time,
+        std::size_t max_runs)
+    {
+        timeit_result result;
+
+        // We scale the number of calls until a run is long enough for the clock to be
+        // accurate. These runs also warm up the caches and the branch predictors.
+        run_result calibration{0, 0};
+        result.loops = 1;
+        while (true)
+        {
+            calibration = run(function, result.loops);
+            if (calibration.seconds >= min_run_time.count() ||
+                result.loops >= 10'000'000'000ULL)
+            {
+                break;
+            }
+            result.loops *= 10;
+        }
+
+        // Slow functions get fewer runs, so that timing does not take forever.
+        const double budget = 10 * min_run_time.count();
+        result.runs = std::clamp<std::size_t>(
+            static_cast<std::size_t>(budget / std::max(calibration.seconds, 1e-9)),
+            1, std::max<std::size_t>(max_runs, 1));
+
+        std::vector<double> times;
+        double min_cycles = 0;
+        for (std::size_t i = 0; i < result.runs; ++i)
+        {
+            const run_result r = run(function, result.loops);
+            const double time = r.seconds / result.loops;
+            if (times.empty() || time < *std::min_element(times.begin(), times.end()))
+            {
+                min_cycles = static_cast<double>(r.cycles) / result.loops;
+            }
+            times.push_back(time);
+        }
+
+        std::sort(times.begin(), times.end());
+        result.min = times.front();
+        result.median = (times.size() % 2 == 1) ? times[times.size() / 2] :
+            (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+        for (double time : times)
+        {
+            result.mean += time;
+        }
+        result.mean /= times.size();
+        if (times.size() > 1)
+        {
+            double variance = 0;
+            for (double time : times)
+            {
+                variance += (time - result.mean) * (time - result.mean);
+            }
+            result.stddev = std::sqrt(variance / (times.size() - 1));
+        }
+        result.cycles = min_cycles;
+        return result;
+    }
+}
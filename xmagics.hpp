@@ -0,0 +1,145 @@
+#ifndef ALS_XEUS_CLING_XMAGICS_HPP
+#define ALS_XEUS_CLING_XMAGICS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "nlohmann/json.hpp"
+#include "als-xeus-cling-config.hpp"
+
+namespace als::xeus_cling
+{
+    namespace nl = nlohmann;
+
+    /**
+     * @brief A magic command, i.e., a cell starting with %name (line magic) or %%name
+     * (cell magic).
+     *
+     */
+    struct ALS_XEUS_CLING_API magic_command
+    {
+        /**
+         * @brief Name of the magic, without the percent signs.
+         *
+         */
+        std::string name;
+
+        /**
+         * @brief The rest of the first line.
+         *
+         */
+        std::string arguments;
+
+        /**
+         * @brief The lines after the first one.
+         *
+         */
+        std::string body;
+
+        bool is_cell_magic;
+    };
+
+    /**
+     * @brief Parses the magic command a cell starts with, if any. C++ code never starts
+     * with a percent sign.
+     *
+     */
+    std::optional<magic_command> parse_magic(std::string_view code);
+
+    /**
+     * @brief The magic commands the kernel knows. More magics can be added from a cell
+     * through xci->magics.
+     *
+     */
+    class ALS_XEUS_CLING_API magic_registry
+    {
+        public:
+
+        /**
+         * @brief Executes a magic command on the thread executing the cells and returns
+         * the content of the execute_reply, as execute_request_impl does.
+         *
+         */
+        using handler = std::function<nl::json(const magic_command& command,
+            int execution_counter)>;
+
+        /**
+         * @brief Adds a magic, replacing the one with the same name if any.
+         *
+         */
+        void add(const std::string& name, handler magic);
+
+        /**
+         * @brief Returns the handler of a magic, or nullptr if there is none.
+         *
+         */
+        const handler* find(const std::string& name) const;
+
+        private:
+
+        std::unordered_map<std::string, handler> m_handlers;
+    };
+
+    /**
+     * @brief Statistics of the time taken by a function, as measured by timeit.
+     *
+     */
+    struct ALS_XEUS_CLING_API timeit_result
+    {
+        /**
+         * @brief Number of calls of every run.
+         *
+         */
+        std::size_t loops = 0;
+
+        /**
+         * @brief Number of timed runs.
+         *
+         */
+        std::size_t runs = 0;
+
+        // Statistics of the time per call of the runs, in seconds.
+        double min = 0;
+        double median = 0;
+        double mean = 0;
+        double stddev = 0;
+
+        /**
+         * @brief Time stamp counter ticks (reference cycles) per call in the fastest run,
+         * or 0 where there is no time stamp counter.
+         *
+         */
+        double cycles = 0;
+
+        nl::json to_json() const;
+
+        /**
+         * @brief A line of text with the statistics, as shown by %timeit.
+         *
+         */
+        std::string report() const;
+    };
+
+    /**
+     * @brief Measures the time taken by a function. The number of calls per run is
+     * scaled, by powers of ten, until a run lasts at least min_run_time, which also
+     * warms up the caches. Then up to max_runs runs are timed, as long as they fit
+     * into ten times min_run_time.
+     *
+     * @param function Function to be measured. It is called through a plain pointer,
+     * so that the overhead of the harness is a single indirect call.
+     * @param min_run_time Minimum duration of a run.
+     * @param max_runs Maximum number of timed runs.
+     * @return timeit_result
+     */
+    timeit_result timeit(void (*function)(),
+        std::chrono::duration<double> min_run_time = std::chrono::milliseconds(200),
+        std::size_t max_runs = 7);
+}
+
+#endif // ALS_XEUS_CLING_XMAGICS_HPP
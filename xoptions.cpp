@@ -0,0 +1,172 @@
+#include <cstdlib>
+#include <sstream>
+#include <string_view>
+
+#include "xoptions.hpp"
+
+namespace
+{
+    using als::xeus_cling::kernel_options;
+
+    bool starts_with(std::string_view text, std::string_view prefix)
+    {
+        return text.substr(0, prefix.size()) == prefix;
+    }
+
+    // Applies the flags to the options. The value of -I, -D, -L, --execute and --output
+    // may be the next argument.
+    void apply_flags(kernel_options& options, const std::vector<std::string>& flags)
+    {
+        for (std::size_t i = 0; i < flags.size(); ++i)
+        {
+            const std::string& flag = flags[i];
+            for (auto [prefix, values] : {std::make_pair("-I", &options.include_paths),
+                std::make_pair("-D", &options.definitions),
+                std::make_pair("-L", &options.library_paths)})
+            {
+                if (flag == prefix && i + 1 < flags.size())
+                {
+                    values->push_back(flags[++i]);
+                }
+                else if (flag.size() > 2 && starts_with(flag, prefix))
+                {
+                    values->push_back(flag.substr(2));
+                }
+            }
+
+            if (flag == "--execute" && i + 1 < flags.size())
+            {
+                options.execute_notebooks.push_back(flags[++i]);
+            }
+            else if (flag == "--output" && i + 1 < flags.size())
+            {
+                options.notebook_output = flags[++i];
+            }
+
+            if (starts_with(flag, "-std="))
+            {
+                options.standard = flag.substr(5);
+            }
+            else if (flag.size() == 3 && starts_with(flag, "-O") && flag[2] >= '0' &&
+                flag[2] <= '3')
+            {
+                options.optimization_level = flag[2] - '0';
+            }
+            else if (starts_with(flag, "-march="))
+            {
+                options.target_cpu = flag.substr(7);
+            }
+            else if (starts_with(flag, "--preload-library="))
+            {
+                options.preload_libraries.push_back(flag.substr(18));
+            }
+            else if (starts_with(flag, "--preload-header="))
+            {
+                options.preload_headers.push_back(flag.substr(17));
+            }
+            else if (starts_with(flag, "--pch="))
+            {
+                options.prelude_pch = flag.substr(6);
+            }
+            else if (flag == "--no-pch")
+            {
+                options.prelude_pch.clear();
+            }
+            else if (starts_with(flag, "--pool="))
+            {
+                options.pool_socket = flag.substr(7);
+            }
+            else if (starts_with(flag, "--pool-size="))
+            {
+                options.pool_size = std::strtoul(flag.c_str() + 12, nullptr, 10);
+            }
+            else if (starts_with(flag, "--pool-recycle="))
+            {
+                options.pool_recycle = std::atoi(flag.c_str() + 15);
+            }
+            else if (starts_with(flag, "--attach="))
+            {
+                options.attach_socket = flag.substr(9);
+            }
+            else if (starts_with(flag, "--journal="))
+            {
+                options.journal_directory = flag.substr(10);
+            }
+            else if (starts_with(flag, "--execute="))
+            {
+                options.execute_notebooks.push_back(flag.substr(10));
+            }
+            else if (starts_with(flag, "--output="))
+            {
+                options.notebook_output = flag.substr(9);
+            }
+            else if (starts_with(flag, "--jobs="))
+            {
+                options.notebook_jobs = std::strtoul(flag.c_str() + 7, nullptr, 10);
+            }
+        }
+    }
+}
+
+namespace als::xeus_cling
+{
+    kernel_options parse_options(int argc, char* argv[])
+    {
+        kernel_options options;
+
+        if (const char* pch = std::getenv("ALS_XEUS_CLING_PRELUDE_PCH"))
+        {
+            options.prelude_pch = pch;
+        }
+        if (const char* environment_flags = std::getenv("ALS_XEUS_CLING_FLAGS"))
+        {
+            std::vector<std::string> flags;
+            std::istringstream stream(environment_flags);
+            std::string flag;
+            while (stream >> flag)
+            {
+                flags.push_back(flag);
+            }
+            apply_flags(options, flags);
+        }
+
+        apply_flags(options, std::vector<std::string>(argv, argv + argc));
+        return options;
+    }
+
+    std::vector<std::string> interpreter_flags(const kernel_options& options)
+    {
+        std::vector<std::string> flags{"-std=" + options.standard};
+        for (const std::string& path : options.include_paths)
+        {
+            flags.push_back("-I" + path);
+        }
+        for (const std::string& definition : options.definitions)
+        {
+            flags.push_back("-D" + definition);
+        }
+        for (const std::string& path : options.library_paths)
+        {
+            flags.push_back("-L" + path);
+        }
+        for (const std::string& library : options.preload_libraries)
+        {
+            flags.push_back("--preload-library=" + library);
+        }
+        for (const std::string& header : options.preload_headers)
+        {
+            flags.push_back("--preload-header=" + header);
+        }
+        flags.push_back(options.prelude_pch.empty() ? "--no-pch" :
+            "--pch=" + options.prelude_pch);
+        if (options.optimization_level >= 0)
+        {
+            flags.push_back("-O" + std::to_string(options.optimization_level));
+        }
+        if (!options.target_cpu.empty())
+        {
+            flags.push_back("-march=" + options.target_cpu);
+        }
+        return flags;
+    }
+}
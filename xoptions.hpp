@@ -0,0 +1,156 @@
+#ifndef ALS_XEUS_CLING_XOPTIONS_HPP
+#define ALS_XEUS_CLING_XOPTIONS_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "als-xeus-cling-config.hpp"
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Options of the kernel, read at startup, so that several kernelspecs (e.g.
+     * C++17 with -O2, C++20 for the native CPU) can share the same binary.
+     *
+     */
+    struct ALS_XEUS_CLING_API kernel_options
+    {
+        /**
+         * @brief Language standard of the cells, as in -std (e.g. "c++17").
+         *
+         */
+        std::string standard = "c++17";
+
+        /**
+         * @brief Include paths. By default, those of cling and of its clang.
+         *
+         */
+        std::vector<std::string> include_paths{ALS_CLANG_INCLUDE_PATH,
+            ALS_CLING_INCLUDE_PATH};
+
+        /**
+         * @brief Macros defined before the first cell, as in -D (NAME or NAME=VALUE).
+         *
+         */
+        std::vector<std::string> definitions;
+
+        /**
+         * @brief Directories where the libraries loaded by the cells are looked for.
+         *
+         */
+        std::vector<std::string> library_paths;
+
+        /**
+         * @brief Libraries loaded before the first cell.
+         *
+         */
+        std::vector<std::string> preload_libraries;
+
+        /**
+         * @brief Headers included before the first cell.
+         *
+         */
+        std::vector<std::string> preload_headers;
+
+        /**
+         * @brief Precompiled prelude. An empty string disables it.
+         *
+         */
+        std::string prelude_pch = ALS_XEUS_CLING_PRELUDE_PCH;
+
+        /**
+         * @brief Optimization level (0 to 3) of the code compiled by the JIT, or -1 to
+         * keep the default of cling.
+         *
+         */
+        int optimization_level = -1;
+
+        /**
+         * @brief CPU the JIT generates code for (e.g. "native"), or an empty string for
+         * the default one.
+         *
+         */
+        std::string target_cpu;
+
+        /**
+         * @brief Socket on which a pool of kernels is run (see run_pool), or an empty
+         * string to run a single kernel.
+         *
+         */
+        std::string pool_socket;
+
+        /**
+         * @brief Number of idle kernels the pool keeps ready.
+         *
+         */
+        std::size_t pool_size = 2;
+
+        /**
+         * @brief Number of seconds after which the pool builds its interpreter again,
+         * or 0 to keep it.
+         *
+         */
+        int pool_recycle = 0;
+
+        /**
+         * @brief Socket of the pool the kernel is started from (see attach_to_pool), or
+         * an empty string to start it in this process.
+         *
+         */
+        std::string attach_socket;
+
+        /**
+         * @brief Directory where the kernel journals its cells (see open_journal), in a
+         * file named after the connection file, or an empty string for no journal.
+         *
+         */
+        std::string journal_directory;
+
+        /**
+         * @brief Notebooks to execute without a frontend (see run_notebooks), instead of
+         * starting a kernel.
+         *
+         */
+        std::vector<std::string> execute_notebooks;
+
+        /**
+         * @brief Where the notebook executed is written, if there is only one. By
+         * default, next to it, with the extension .nbconvert.ipynb.
+         *
+         */
+        std::string notebook_output;
+
+        /**
+         * @brief Number of notebooks executed in parallel.
+         *
+         */
+        std::size_t notebook_jobs = 1;
+    };
+
+    /**
+     * @brief Reads the options of the kernel from the environment and the command line,
+     * in this order, so that the command line (the argv of kernel.json) wins.
+     *
+     * The environment variable ALS_XEUS_CLING_FLAGS may contain any of the flags below,
+     * separated by spaces, and ALS_XEUS_CLING_PRELUDE_PCH the path of the precompiled
+     * prelude. The flags are: -std=STANDARD, -I PATH, -D NAME[=VALUE], -L PATH, -O0 to
+     * -O3, -march=CPU, --preload-library=LIBRARY, --preload-header=HEADER, --pch=PATH,
+     * --no-pch, --pool=SOCKET, --pool-size=N, --pool-recycle=SECONDS,
+     * --attach=SOCKET, --journal=DIRECTORY, --execute NOTEBOOK, --output NOTEBOOK and
+     * --jobs=N. Other arguments are ignored.
+     *
+     */
+    kernel_options parse_options(int argc, char* argv[]);
+
+    /**
+     * @brief Returns the flags the interpreter of a kernel is built with (the language
+     * standard, the paths, the macros, what is preloaded, the precompiled prelude and
+     * the code generation), in a canonical form, so that the interpreters built from
+     * two sets of options can be compared.
+     *
+     */
+    std::vector<std::string> interpreter_flags(const kernel_options& options);
+}
+
+#endif // ALS_XEUS_CLING_XOPTIONS_HPP
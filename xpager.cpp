@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <utility>
+
+#include "xpager.hpp"
+
+namespace als::xeus_cling
+{
+    pager_registry::pager_registry(): m_next_id{0}
+    {
+    }
+
+    std::size_t pager_registry::add(std::size_t size, page_function page,
+        std::size_t max_pagers)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::size_t id = m_next_id++;
+        m_pagers.push_back({id, size, std::move(page)});
+        while (m_pagers.size() > std::max<std::size_t>(max_pagers, 1))
+        {
+            m_pagers.pop_front();
+        }
+        return id;
+    }
+
+    bool pager_registry::page(std::size_t id, std::size_t start, std::size_t count,
+        std::vector<std::string>& elements, std::size_t& size) const
+    {
+        // The page is formatted without the lock, since it may take long, so we keep a
+        // copy of the function in case the pager is removed meanwhile.
+        page_function page;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // Ids are increasing, so the pagers are sorted by id.
+            auto found = std::lower_bound(m_pagers.begin(), m_pagers.end(), id,
+                [](const pager& p, std::size_t value) { return p.id < value; });
+            if (found == m_pagers.end() || found->id != id)
+            {
+                return false;
+            }
+            size = found->size;
+            page = found->page;
+        }
+
+        elements.clear();
+        if (start < size)
+        {
+            elements = page(start, std::min(count, size - start));
+        }
+        return true;
+    }
+
+    std::size_t pager_registry::next_id() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_next_id;
+    }
+
+    void pager_registry::remove_since(std::size_t id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (!m_pagers.empty() && m_pagers.back().id >= id)
+        {
+            m_pagers.pop_back();
+        }
+    }
+}
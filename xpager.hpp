@@ -0,0 +1,136 @@
+#ifndef ALS_XEUS_CLING_XPAGER_HPP
+#define ALS_XEUS_CLING_XPAGER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "als-xeus-cling-config.hpp"
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Limits applied to the representation of the objects displayed. They can be
+     * changed from a cell through xci->display_budget.
+     *
+     */
+    struct ALS_XEUS_CLING_API display_limits
+    {
+        /**
+         * @brief Containers with more elements are summarized: only their first and last
+         * elements are formatted, and the rest can be requested by the frontend later.
+         *
+         */
+        std::size_t max_elements = 100;
+
+        /**
+         * @brief Plain representations longer than this are truncated. Latex ones are
+         * replaced by the plain representation, since rendering them would freeze the
+         * browser.
+         *
+         */
+        std::size_t max_bytes = 64 * 1024;
+
+        /**
+         * @brief Number of summarized objects whose elements can still be requested. The
+         * oldest ones are forgotten first.
+         *
+         */
+        std::size_t max_pagers = 16;
+
+        /**
+         * @brief If set, a summarized object is copied so that its elements can be
+         * requested later. Otherwise, only the results of the cells and the objects
+         * displayed through a std::shared_ptr can be, since the pager shares them.
+         *
+         */
+        bool copy_summarized = false;
+
+        /**
+         * @brief Displays merged by a display_batch are published at the latest this
+         * time after the first of them, even if the batch has not ended.
+         *
+         */
+        std::chrono::milliseconds batch_interval{100};
+    };
+
+    /**
+     * @brief Keeps the summarized objects, so that their elements can be formatted when
+     * the frontend requests them, page by page, instead of when they are displayed.
+     *
+     * Pagers are added by the thread executing the cells and used by the thread
+     * answering the frontend, so every method is thread safe.
+     *
+     */
+    class ALS_XEUS_CLING_API pager_registry
+    {
+        public:
+
+        /**
+         * @brief Formats the elements [start, start + count) of an object. The range is
+         * always within the object.
+         *
+         */
+        using page_function = std::function<std::vector<std::string>(std::size_t start,
+            std::size_t count)>;
+
+        pager_registry();
+
+        /**
+         * @brief Adds a pager and returns its id.
+         *
+         * @param size Number of elements of the object.
+         * @param page Function formatting the elements. It must own what it formats.
+         * @param max_pagers The oldest pagers are removed so that at most max_pagers
+         * are kept.
+         * @return std::size_t
+         */
+        std::size_t add(std::size_t size, page_function page, std::size_t max_pagers);
+
+        /**
+         * @brief Formats a page of elements.
+         *
+         * @param id Id of the pager.
+         * @param start First element of the page. Pages past the end are empty.
+         * @param count Number of elements requested.
+         * @param elements Set to the formatted elements.
+         * @param size Set to the number of elements of the object.
+         * @return false if the pager does not exist (anymore).
+         */
+        bool page(std::size_t id, std::size_t start, std::size_t count,
+            std::vector<std::string>& elements, std::size_t& size) const;
+
+        /**
+         * @brief The id the next pager will get.
+         *
+         */
+        std::size_t next_id() const;
+
+        /**
+         * @brief Removes the pagers added since next_id returned id, e.g. because the
+         * code of their functions has been unloaded.
+         *
+         */
+        void remove_since(std::size_t id);
+
+        private:
+
+        struct pager
+        {
+            std::size_t id;
+            std::size_t size;
+            page_function page;
+        };
+
+        mutable std::mutex m_mutex;
+        // From the oldest to the newest.
+        std::deque<pager> m_pagers;
+        std::size_t m_next_id;
+    };
+}
+
+#endif // ALS_XEUS_CLING_XPAGER_HPP
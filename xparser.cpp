@@ -7,35 +7,28 @@
 * The full license is in the file LICENSE, distributed with this software.         *
 ************************************************************************************/
 
-#include <algorithm>
-#include <iostream>
-#include <regex>
-#include <sstream>
-#include <string>
+#include <string_view>
 #include <vector>
 
 #include "xparser.hpp"
 
 namespace xcpp
 {
-    std::vector<std::string> split_line(const std::string& input, const std::string& delims, std::size_t cursor_pos)
+    std::vector<std::string_view> split_line(std::string_view input, std::string_view delims,
+        std::size_t cursor_pos)
     {
-        // passing -1 as the submatch index parameter performs splitting
-        std::vector<std::string> result;
-        std::stringstream ss;
+        std::vector<std::string_view> result;
+        std::string_view line = input.substr(0, cursor_pos);
 
-        ss << "[";
-        for (auto c : delims)
+        std::size_t start = 0;
+        std::size_t end = line.find_first_of(delims);
+        while (end != std::string_view::npos)
         {
-            ss << "\\" << c;
+            result.push_back(line.substr(start, end - start));
+            start = end + 1;
+            end = line.find_first_of(delims, start);
         }
-        ss << "]";
-
-        std::regex re(ss.str());
-
-        std::copy(std::sregex_token_iterator(input.begin(), input.begin() + cursor_pos + 1, re, -1),
-                  std::sregex_token_iterator(),
-                  std::back_inserter(result));
+        result.push_back(line.substr(start));
 
         return result;
     }
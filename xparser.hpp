@@ -12,12 +12,16 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace xcpp
 {
-    std::vector<std::string> split_line(const std::string& input,
-        const std::string& delims, std::size_t cursor_pos);
+    // Splits the part of input before cursor_pos at every character of delims. The
+    // last token is the (possibly empty) word in front of the cursor. The tokens are
+    // views into input.
+    std::vector<std::string_view> split_line(std::string_view input,
+        std::string_view delims, std::size_t cursor_pos);
 }
 
 #endif // XCPP_PARSER_HPP
\ No newline at end of file
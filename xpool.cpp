@@ -0,0 +1,679 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "nlohmann/json.hpp"
+
+#include "xinterrupt.hpp"
+#include "xpool.hpp"
+
+extern char** environ;
+
+namespace nl = nlohmann;
+
+namespace
+{
+    // Everything touched by the signal handlers is a sig_atomic_t.
+    volatile std::sig_atomic_t stop_requested = 0;
+    volatile std::sig_atomic_t recycle_requested = 0;
+    volatile std::sig_atomic_t retirement_requested = 0;
+    // Kernel the signals of the launcher are forwarded to.
+    volatile std::sig_atomic_t kernel_pid = 0;
+
+    void request_stop(int)
+    {
+        stop_requested = 1;
+    }
+
+    void request_recycle(int)
+    {
+        recycle_requested = 1;
+    }
+
+    void request_retirement(int)
+    {
+        retirement_requested = 1;
+    }
+
+    void forward_signal(int signal)
+    {
+        if (kernel_pid > 0)
+        {
+            kill(kernel_pid, signal);
+        }
+    }
+
+    void set_handler(int signal, void (*handler)(int))
+    {
+        struct sigaction action = {};
+        action.sa_handler = handler;
+        sigemptyset(&action.sa_mask);
+        sigaction(signal, &action, nullptr);
+    }
+
+    void set_blocked(int signal, bool blocked)
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, signal);
+        sigprocmask(blocked ? SIG_BLOCK : SIG_UNBLOCK, &mask, nullptr);
+    }
+
+    // Sent by the supervisor to the idle kernels it no longer needs. Kernels serving a
+    // launcher ignore it.
+    constexpr int retirement_signal = SIGUSR1;
+
+    // Time given to a launcher to send its request, and to a kernel to answer it.
+    constexpr int request_timeout = 10000;
+
+    // The descriptors shared by the supervisor and its kernels, and the idle kernels of
+    // the previous interpreter. They are passed through this variable when the
+    // supervisor executes itself again, so that no launcher is lost meanwhile.
+    constexpr const char* state_variable = "ALS_XEUS_CLING_POOL_STATE";
+
+    struct pool_state
+    {
+        int listener = -1;
+        // Idle kernels write their pid into this pipe when they accept a launcher.
+        int status_read = -1;
+        int status_write = -1;
+        std::vector<pid_t> previous_kernels;
+    };
+
+    std::optional<pool_state> inherited_state()
+    {
+        const char* value = std::getenv(state_variable);
+        if (value == nullptr)
+        {
+            return std::nullopt;
+        }
+
+        pool_state state;
+        std::istringstream stream(value);
+        stream >> state.listener >> state.status_read >> state.status_write;
+        pid_t pid;
+        while (stream >> pid)
+        {
+            state.previous_kernels.push_back(pid);
+        }
+        unsetenv(state_variable);
+        return state;
+    }
+
+    bool make_address(const std::string& socket_path, sockaddr_un& address)
+    {
+        address = {};
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path))
+        {
+            return false;
+        }
+        std::strcpy(address.sun_path, socket_path.c_str());
+        return true;
+    }
+
+    bool open_pool(const std::string& socket_path, pool_state& state)
+    {
+        sockaddr_un address;
+        if (!make_address(socket_path, address))
+        {
+            return false;
+        }
+
+        state.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (state.listener == -1)
+        {
+            return false;
+        }
+        unlink(socket_path.c_str());
+        const mode_t previous_mask = umask(0177);
+        const bool bound = bind(state.listener, reinterpret_cast<sockaddr*>(&address),
+            sizeof(address)) == 0;
+        umask(previous_mask);
+        // Several idle kernels wait for the same launcher: those which lose the race
+        // must not block in accept.
+        if (!bound || listen(state.listener, SOMAXCONN) != 0 ||
+            fcntl(state.listener, F_SETFL, O_NONBLOCK) != 0)
+        {
+            close(state.listener);
+            return false;
+        }
+
+        int status_pipe[2];
+        if (pipe(status_pipe) != 0)
+        {
+            close(state.listener);
+            return false;
+        }
+        state.status_read = status_pipe[0];
+        state.status_write = status_pipe[1];
+        fcntl(state.status_read, F_SETFL, O_NONBLOCK);
+        return true;
+    }
+
+    // Asks the idle kernels to exit. The pids are only signaled while they are still
+    // children of the supervisor, i.e. they have not been reused.
+    void retire(const std::vector<pid_t>& kernels)
+    {
+        for (pid_t pid : kernels)
+        {
+            int status;
+            if (waitpid(pid, &status, WNOHANG) == 0)
+            {
+                kill(pid, retirement_signal);
+            }
+        }
+    }
+
+    bool write_all(int fd, const std::string& text)
+    {
+        std::size_t written = 0;
+        while (written < text.size())
+        {
+            const ssize_t count = send(fd, text.data() + written, text.size() - written,
+                MSG_NOSIGNAL);
+            if (count == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            written += count;
+        }
+        return true;
+    }
+
+    // Reads the next line from fd, waiting at most timeout milliseconds (-1 waits
+    // forever) for every chunk. Returns false at the end of the file, on error or
+    // timeout.
+    bool read_line(int fd, std::string& buffer, std::string& line, int timeout)
+    {
+        while (true)
+        {
+            const std::size_t end = buffer.find('\n');
+            if (end != std::string::npos)
+            {
+                line = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                return true;
+            }
+
+            pollfd polled = {fd, POLLIN, 0};
+            const int ready = poll(&polled, 1, timeout);
+            if (ready == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ready <= 0)
+            {
+                return false;
+            }
+
+            char chunk[4096];
+            const ssize_t count = read(fd, chunk, sizeof(chunk));
+            if (count == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            buffer.append(chunk, count);
+        }
+    }
+
+    // Sends the request of the launcher, along with its standard streams.
+    bool send_request(int connection, const std::string& request)
+    {
+        int streams[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        iovec data = {const_cast<char*>(request.data()), request.size()};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(streams))] = {};
+        msghdr message = {};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(streams));
+        std::memcpy(CMSG_DATA(header), streams, sizeof(streams));
+
+        ssize_t sent;
+        do
+        {
+            sent = sendmsg(connection, &message, MSG_NOSIGNAL);
+        }
+        while (sent == -1 && errno == EINTR);
+        return sent > 0 && write_all(connection, request.substr(sent));
+    }
+
+    // Receives the beginning of the request of a launcher into buffer, and its
+    // standard streams.
+    bool receive_request(int connection, std::string& buffer, int (&streams)[3])
+    {
+        pollfd polled = {connection, POLLIN, 0};
+        if (poll(&polled, 1, request_timeout) <= 0)
+        {
+            return false;
+        }
+
+        char chunk[4096];
+        iovec data = {chunk, sizeof(chunk)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(streams))];
+        msghdr message = {};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        const ssize_t count = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+        const cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (count <= 0 || header == nullptr || header->cmsg_level != SOL_SOCKET ||
+            header->cmsg_type != SCM_RIGHTS ||
+            header->cmsg_len != CMSG_LEN(sizeof(streams)))
+        {
+            return false;
+        }
+        buffer.append(chunk, count);
+        std::memcpy(streams, CMSG_DATA(header), sizeof(streams));
+        return true;
+    }
+
+    // Exits as soon as the launcher disappears, since nobody could stop the kernel
+    // otherwise.
+    void watch_launcher(int connection)
+    {
+        while (true)
+        {
+            pollfd polled = {connection, POLLRDHUP, 0};
+            if (poll(&polled, 1, -1) == -1)
+            {
+                continue;
+            }
+            if (polled.revents & (POLLRDHUP | POLLHUP | POLLERR))
+            {
+                _exit(1);
+            }
+        }
+    }
+
+    // Describes the first difference between the flags of the pool and those of a
+    // launcher.
+    std::string describe_difference(const std::vector<std::string>& pool_flags,
+        const std::vector<std::string>& launcher_flags)
+    {
+        const auto [pool_flag, launcher_flag] = std::mismatch(pool_flags.begin(),
+            pool_flags.end(), launcher_flags.begin(), launcher_flags.end());
+        return "the pool has been built with " +
+            (pool_flag != pool_flags.end() ? *pool_flag : std::string("nothing more")) +
+            " where the launcher has " + (launcher_flag != launcher_flags.end() ?
+                *launcher_flag : std::string("nothing more"));
+    }
+
+    // Reads the request of a launcher and its standard streams. Returns why the kernel
+    // can not serve it, or an empty string if it can.
+    std::string read_request(int connection, const std::vector<std::string>& flags,
+        int (&streams)[3], nl::json& request)
+    {
+        std::string buffer;
+        std::string line;
+        if (!receive_request(connection, buffer, streams))
+        {
+            return "no launch request received";
+        }
+
+        std::string refusal;
+        try
+        {
+            if (!read_line(connection, buffer, line, request_timeout))
+            {
+                refusal = "incomplete launch request";
+            }
+            else
+            {
+                request = nl::json::parse(line);
+                const std::vector<std::string> launcher_flags =
+                    request.at("interpreter_flags").get<std::vector<std::string>>();
+                if (launcher_flags != flags)
+                {
+                    refusal = describe_difference(flags, launcher_flags);
+                }
+            }
+        }
+        catch (const std::exception& error)
+        {
+            refusal = std::string("invalid launch request: ") + error.what();
+        }
+
+        if (!refusal.empty())
+        {
+            for (int fd : streams)
+            {
+                close(fd);
+            }
+        }
+        return refusal;
+    }
+
+    // Waits for a launcher in an idle kernel, then serves it. Never returns.
+    [[noreturn]] void run_kernel(pool_state& state, pid_t supervisor,
+        const std::vector<std::string>& flags,
+        const std::function<int(const std::string& connection_file,
+            const std::string& journal_directory)>& serve)
+    {
+        close(state.status_read);
+        set_handler(SIGTERM, SIG_DFL);
+        set_handler(SIGHUP, SIG_DFL);
+        als::xeus_cling::install_interrupt_handler();
+
+        // The retirement signal is only received while waiting in ppoll, so that it
+        // can not be missed between checking the flag and waiting.
+        set_handler(retirement_signal, request_retirement);
+        set_blocked(retirement_signal, true);
+        sigset_t waiting_mask;
+        sigprocmask(SIG_SETMASK, nullptr, &waiting_mask);
+        sigdelset(&waiting_mask, retirement_signal);
+        prctl(PR_SET_PDEATHSIG, retirement_signal);
+        if (getppid() != supervisor)
+        {
+            _exit(0);
+        }
+
+        // The request is read before the kernel is taken over, so that a kernel that
+        // can not serve it goes back to waiting.
+        int connection = -1;
+        int streams[3];
+        nl::json request;
+        while (connection == -1)
+        {
+            pollfd polled = {state.listener, POLLIN, 0};
+            ppoll(&polled, 1, nullptr, &waiting_mask);
+            if (retirement_requested)
+            {
+                _exit(0);
+            }
+            connection = accept(state.listener, nullptr, nullptr);
+            if (connection == -1)
+            {
+                continue;
+            }
+
+            const std::string refusal = read_request(connection, flags, streams, request);
+            if (!refusal.empty())
+            {
+                std::clog << "als-xeus-cling-kernel: refused a launcher: " << refusal
+                    << std::endl;
+                write_all(connection, nl::json{{"refused", refusal}}.dump() + "\n");
+                close(connection);
+                connection = -1;
+            }
+        }
+
+        // From now on, the kernel belongs to the launcher.
+        set_handler(retirement_signal, SIG_IGN);
+        set_blocked(retirement_signal, false);
+        prctl(PR_SET_PDEATHSIG, 0);
+        close(state.listener);
+        const pid_t pid = getpid();
+        while (write(state.status_write, &pid, sizeof(pid)) == -1 && errno == EINTR)
+        {
+        }
+        close(state.status_write);
+        // The interruptions of the supervisor (e.g. Ctrl-C in its terminal) must not
+        // reach the kernel.
+        setsid();
+
+        try
+        {
+            clearenv();
+            for (const auto& [name, value] : request.at("environment").items())
+            {
+                setenv(name.c_str(), value.get<std::string>().c_str(), 1);
+            }
+            std::filesystem::current_path(
+                request.at("working_directory").get<std::string>());
+        }
+        catch (const std::exception& error)
+        {
+            std::clog << "als-xeus-cling-kernel: invalid launch request: " << error.what()
+                << std::endl;
+            _exit(1);
+        }
+
+        std::fflush(stdout);
+        std::fflush(stderr);
+        for (int fd = 0; fd < 3; ++fd)
+        {
+            dup2(streams[fd], fd);
+            close(streams[fd]);
+        }
+
+        if (!write_all(connection, nl::json{{"pid", pid}}.dump() + "\n"))
+        {
+            _exit(1);
+        }
+        std::thread(watch_launcher, connection).detach();
+
+        const int exit_status = serve(request.at("connection_file").get<std::string>(),
+            request.value("journal_directory", ""));
+        std::cout.flush();
+        std::clog.flush();
+        std::fflush(nullptr);
+        write_all(connection, nl::json{{"exit_status", exit_status}}.dump() + "\n");
+        _exit(exit_status);
+    }
+}
+
+namespace als::xeus_cling
+{
+    int run_pool(const std::string& socket_path, std::size_t size,
+        std::chrono::seconds recycle_after, char* argv[],
+        const std::vector<std::string>& flags,
+        const std::function<int(const std::string& connection_file,
+            const std::string& journal_directory)>& serve)
+    {
+        pool_state state;
+        if (std::optional<pool_state> inherited = inherited_state())
+        {
+            state = *inherited;
+        }
+        else if (!open_pool(socket_path, state))
+        {
+            std::clog << "als-xeus-cling-kernel: could not listen on " << socket_path
+                << std::endl;
+            return 1;
+        }
+
+        const pid_t supervisor = getpid();
+        set_handler(SIGINT, request_stop);
+        set_handler(SIGTERM, request_stop);
+        set_handler(SIGHUP, request_recycle);
+        set_blocked(SIGINT, false);
+        const auto recycle_time = std::chrono::steady_clock::now() + recycle_after;
+        std::clog << "als-xeus-cling-kernel: pool of " << size << " kernels listening on "
+            << socket_path << std::endl;
+
+        std::set<pid_t> idle_kernels;
+        while (!stop_requested && !recycle_requested)
+        {
+            while (idle_kernels.size() < size)
+            {
+                const pid_t pid = fork();
+                if (pid == 0)
+                {
+                    run_kernel(state, supervisor, flags, serve);
+                }
+                if (pid == -1)
+                {
+                    std::clog << "als-xeus-cling-kernel: could not start a kernel: "
+                        << std::strerror(errno) << std::endl;
+                    break;
+                }
+                idle_kernels.insert(pid);
+            }
+
+            // The kernels of the previous interpreter are retired once those of the
+            // new one are ready.
+            retire(state.previous_kernels);
+            state.previous_kernels.clear();
+
+            pollfd polled = {state.status_read, POLLIN, 0};
+            if (poll(&polled, 1, 1000) > 0)
+            {
+                pid_t pid;
+                while (read(state.status_read, &pid, sizeof(pid)) == sizeof(pid))
+                {
+                    idle_kernels.erase(pid);
+                }
+            }
+
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                idle_kernels.erase(pid);
+            }
+
+            if (recycle_after.count() > 0 &&
+                std::chrono::steady_clock::now() >= recycle_time)
+            {
+                recycle_requested = 1;
+            }
+        }
+
+        if (!stop_requested)
+        {
+            std::ostringstream value;
+            value << state.listener << " " << state.status_read << " "
+                << state.status_write;
+            for (pid_t pid : idle_kernels)
+            {
+                value << " " << pid;
+            }
+            setenv(state_variable, value.str().c_str(), 1);
+
+            std::clog << "als-xeus-cling-kernel: rebuilding the interpreter of the pool"
+                << std::endl;
+            execv("/proc/self/exe", argv);
+            std::clog << "als-xeus-cling-kernel: could not rebuild the interpreter: "
+                << std::strerror(errno) << std::endl;
+            unsetenv(state_variable);
+        }
+
+        retire(std::vector<pid_t>(idle_kernels.begin(), idle_kernels.end()));
+        unlink(socket_path.c_str());
+        close(state.listener);
+        return 0;
+    }
+
+    std::optional<int> attach_to_pool(const std::string& socket_path,
+        const std::string& connection_file, const kernel_options& options)
+    {
+        sockaddr_un address;
+        if (!make_address(socket_path, address))
+        {
+            return std::nullopt;
+        }
+        const int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connection == -1)
+        {
+            return std::nullopt;
+        }
+        if (connect(connection, reinterpret_cast<sockaddr*>(&address),
+            sizeof(address)) != 0)
+        {
+            close(connection);
+            return std::nullopt;
+        }
+
+        nl::json environment = nl::json::object();
+        for (char** variable = environ; *variable != nullptr; ++variable)
+        {
+            const std::string entry = *variable;
+            const std::size_t equal = entry.find('=');
+            if (equal != std::string::npos)
+            {
+                environment[entry.substr(0, equal)] = entry.substr(equal + 1);
+            }
+        }
+        const nl::json request = {
+            {"connection_file", std::filesystem::absolute(connection_file).string()},
+            {"working_directory", std::filesystem::current_path().string()},
+            {"environment", environment},
+            {"interpreter_flags", interpreter_flags(options)},
+            {"journal_directory", options.journal_directory}};
+
+        std::string buffer;
+        std::string line;
+        int pid = 0;
+        try
+        {
+            if (!send_request(connection, request.dump() + "\n") ||
+                !read_line(connection, buffer, line, request_timeout))
+            {
+                close(connection);
+                return std::nullopt;
+            }
+            const nl::json reply = nl::json::parse(line);
+            if (reply.contains("refused"))
+            {
+                std::clog << "als-xeus-cling-kernel: the pool on " << socket_path
+                    << " can not start this kernel: "
+                    << reply["refused"].get<std::string>() << std::endl;
+                close(connection);
+                return std::nullopt;
+            }
+            pid = reply.at("pid").get<int>();
+        }
+        catch (const std::exception&)
+        {
+            close(connection);
+            return std::nullopt;
+        }
+
+        // Jupyter signals the launcher, which is the process it has started.
+        kernel_pid = pid;
+        for (int signal : {SIGINT, SIGTERM, SIGHUP, SIGQUIT})
+        {
+            set_handler(signal, forward_signal);
+        }
+        set_blocked(SIGINT, false);
+
+        int exit_status = 1;
+        try
+        {
+            if (read_line(connection, buffer, line, -1))
+            {
+                exit_status = nl::json::parse(line).at("exit_status").get<int>();
+            }
+        }
+        catch (const std::exception&)
+        {
+        }
+        close(connection);
+        return exit_status;
+    }
+}
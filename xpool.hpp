@@ -0,0 +1,65 @@
+#ifndef ALS_XEUS_CLING_XPOOL_HPP
+#define ALS_XEUS_CLING_XPOOL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "xoptions.hpp"
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Runs a pool of kernels, so that starting one does not cost the creation of
+     * an interpreter. The calling process (the supervisor), which has already built and
+     * preloaded its interpreter, forks idle copies of itself which wait on a unix
+     * socket. The first copy that accepts a launcher (see attach_to_pool) checks that
+     * the launcher wants an interpreter built with the same flags; if so, it takes the
+     * environment, working directory and standard streams of the launcher, and calls
+     * serve, while the supervisor forks a replacement. Otherwise, it refuses the
+     * launcher and goes back to waiting.
+     *
+     * Every recycle_after (unless it is zero) or on SIGHUP, the supervisor executes
+     * itself again to build a new interpreter, so that the changes made to the
+     * preloaded headers and libraries are picked up. The idle copies of the previous
+     * interpreter keep serving until the new ones are ready. The supervisor stops on
+     * SIGINT or SIGTERM; the kernels it has started keep running.
+     *
+     * Must be called from the main thread, before any other thread is created.
+     *
+     * @param socket_path Path of the socket. Only the current user can connect to it.
+     * @param size Number of idle copies kept ready.
+     * @param recycle_after Age after which the interpreter is built again.
+     * @param argv Command line of the supervisor, used to execute it again.
+     * @param flags Flags the interpreter has been built with (see interpreter_flags).
+     * @param serve Function called in the copy that has accepted a launcher, with the
+     * connection file and the journal directory given to the launcher. It returns the
+     * exit status of the kernel.
+     * @return int Exit status of the supervisor.
+     */
+    int run_pool(const std::string& socket_path, std::size_t size,
+        std::chrono::seconds recycle_after, char* argv[],
+        const std::vector<std::string>& flags,
+        const std::function<int(const std::string& connection_file,
+            const std::string& journal_directory)>& serve);
+
+    /**
+     * @brief Starts a kernel from the pool listening on socket_path, forwards to it the
+     * signals received by the calling process (SIGINT, SIGTERM, SIGHUP and SIGQUIT) and
+     * waits until it exits. The kernel exits if the calling process is killed.
+     *
+     * @param socket_path Path of the socket of the pool.
+     * @param connection_file Connection file the kernel must use.
+     * @param options Options of the calling process. The kernel must have been built
+     * with the same interpreter_flags, and uses its journal_directory.
+     * @return std::optional<int> The exit status of the kernel, or nothing if no kernel
+     * could be started from the pool, e.g. because it has been built with other flags.
+     */
+    std::optional<int> attach_to_pool(const std::string& socket_path,
+        const std::string& connection_file, const kernel_options& options);
+}
+
+#endif // ALS_XEUS_CLING_XPOOL_HPP
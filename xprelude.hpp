@@ -0,0 +1,11 @@
+#ifndef ALS_XEUS_CLING_XPRELUDE_HPP
+#define ALS_XEUS_CLING_XPRELUDE_HPP
+
+// Everything the kernel makes available to the cells before the first one is
+// executed. This header is precompiled at installation time (see the prelude
+// target of the Makefile) so that the interpreter does not have to parse it
+// again on every kernel start.
+#include "xinterpreter.hpp"
+#include "xdisplay.hpp"
+
+#endif // ALS_XEUS_CLING_XPRELUDE_HPP
@@ -0,0 +1,89 @@
+#ifndef ALS_XEUS_CLING_XQUEUE_HPP
+#define ALS_XEUS_CLING_XQUEUE_HPP
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Unbounded lock-free queue with many producers and a single consumer.
+     *
+     * Pushing is one atomic exchange and one store, so producers never wait for each
+     * other nor for the consumer. The consumer may see the queue empty while an element
+     * is being pushed; it gets it on its next pop.
+     *
+     */
+    template <class T>
+    class mpsc_queue
+    {
+        public:
+
+        mpsc_queue():
+            m_tail{new node}
+        {
+            m_head.store(m_tail, std::memory_order_relaxed);
+        }
+
+        mpsc_queue(const mpsc_queue&) = delete;
+        mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+        ~mpsc_queue()
+        {
+            while (pop())
+            {
+            }
+            delete m_tail;
+        }
+
+        /**
+         * @brief Appends value. It can be called from any thread.
+         *
+         */
+        void push(T value)
+        {
+            node* pushed = new node;
+            pushed->value.emplace(std::move(value));
+            node* previous = m_head.exchange(pushed, std::memory_order_acq_rel);
+            previous->next.store(pushed, std::memory_order_release);
+        }
+
+        /**
+         * @brief Removes the first element, if any. It must only be called from one
+         * thread at a time.
+         *
+         */
+        std::optional<T> pop()
+        {
+            node* next = m_tail->next.load(std::memory_order_acquire);
+            if (next == nullptr)
+            {
+                return std::nullopt;
+            }
+
+            // The first node never holds a value: it is the one before the first
+            // element.
+            std::optional<T> value = std::move(next->value);
+            next->value.reset();
+            delete m_tail;
+            m_tail = next;
+            return value;
+        }
+
+        private:
+
+        struct node
+        {
+            std::atomic<node*> next{nullptr};
+            std::optional<T> value;
+        };
+
+        // Last node, where producers append.
+        std::atomic<node*> m_head;
+        // Node before the first element, only used by the consumer.
+        node* m_tail;
+    };
+}
+
+#endif // ALS_XEUS_CLING_XQUEUE_HPP
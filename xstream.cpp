@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "xinterrupt.hpp"
+#include "xstream.hpp"
+
+namespace als::xeus_cling
+{
+    struct output_stream::shared_state
+    {
+        shared_state(publisher publish, const output_limits& limits):
+            publish{std::move(publish)},
+            limits{limits},
+            ring(limits.tail_bytes)
+        {
+        }
+
+        // Publishes text written by a thread, within the limits, and keeps its end in
+        // the ring buffer.
+        void hand_over(const std::string& text)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ring.empty())
+            {
+                const std::size_t kept = std::min(text.size(), ring.size());
+                for (std::size_t i = text.size() - kept; i < text.size(); ++i)
+                {
+                    ring[(written + i) % ring.size()] = text[i];
+                }
+            }
+            written += text.size();
+
+            const std::size_t accepted = std::min(text.size(), limits.max_bytes - accepted_bytes);
+            accepted_bytes += accepted;
+            dropped += text.size() - accepted;
+            if (accepted > 0)
+            {
+                publish(text.substr(0, accepted));
+            }
+        }
+
+        // Returns what has been written from since (at most the size of the ring
+        // buffer), followed by pending, which the calling thread has not handed over.
+        std::string recent_output(std::size_t since, const std::string& pending)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const std::size_t first = std::max({since, written - std::min(written,
+                ring.size())});
+
+            std::string res;
+            for (std::size_t i = first; i < written; ++i)
+            {
+                res.push_back(ring[i % ring.size()]);
+            }
+            res.append(pending, std::min(pending.size(), since - std::min(since, written)),
+                std::string::npos);
+            return res;
+        }
+
+        std::mutex mutex;
+        const publisher publish;
+        const output_limits limits;
+        std::vector<char> ring;
+        std::size_t written = 0;
+        std::size_t accepted_bytes = 0;
+        std::size_t dropped = 0;
+        // Set when the stream is destroyed: what is still pending is dropped.
+        std::atomic<bool> closed{false};
+    };
+
+    struct output_stream::thread_buffer
+    {
+        explicit thread_buffer(std::shared_ptr<shared_state> state):
+            state{std::move(state)},
+            last_publication{std::chrono::steady_clock::now()}
+        {
+        }
+
+        // The thread exits.
+        ~thread_buffer()
+        {
+            if (!pending.empty() && !state->closed)
+            {
+                state->hand_over(pending);
+            }
+        }
+
+        std::shared_ptr<shared_state> state;
+        std::string pending;
+        std::chrono::steady_clock::time_point last_publication;
+    };
+
+    output_stream::output_stream(publisher publish, const output_limits& limits):
+        m_state{std::make_shared<shared_state>(std::move(publish), limits)}
+    {
+        // There is no put area: every write goes through xsputn or overflow, into the
+        // buffer of the writing thread.
+        setp(nullptr, nullptr);
+    }
+
+    output_stream::~output_stream()
+    {
+        m_state->closed = true;
+    }
+
+    // Every entry point defers the interruptions of the cell (see interrupt_guard): an
+    // interruption while the lock is held, or the buffer of the thread is being
+    // changed, would leave them so for the rest of the session.
+
+    void output_stream::finish()
+    {
+        interrupt_guard guard;
+        publish_pending(local_buffer(), true);
+
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        if (m_state->dropped > 0)
+        {
+            // The dropped bytes are the last ones written, so the end of the ring buffer
+            // holds the end of them.
+            const std::size_t shown = std::min(m_state->dropped, m_state->ring.size());
+            std::string notice = "\n[... " + std::to_string(m_state->dropped - shown) +
+                " bytes of output truncated ...]\n";
+            std::string tail;
+            for (std::size_t i = m_state->written - shown; i < m_state->written; ++i)
+            {
+                tail.push_back(m_state->ring[i % m_state->ring.size()]);
+            }
+            m_state->publish(notice + tail);
+            m_state->dropped = 0;
+        }
+    }
+
+    std::size_t output_stream::written()
+    {
+        interrupt_guard guard;
+        const thread_buffer& buffer = local_buffer();
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        return m_state->written + buffer.pending.size();
+    }
+
+    std::string output_stream::recent_output(std::size_t since)
+    {
+        interrupt_guard guard;
+        return m_state->recent_output(since, local_buffer().pending);
+    }
+
+    void output_stream::write_through(const std::string& text)
+    {
+        if (!text.empty())
+        {
+            interrupt_guard guard;
+            m_state->hand_over(text);
+        }
+    }
+
+    output_stream::int_type output_stream::overflow(int_type c)
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            interrupt_guard guard;
+            thread_buffer& buffer = local_buffer();
+            buffer.pending.push_back(traits_type::to_char_type(c));
+            if (buffer.pending.size() >= m_state->limits.flush_size)
+            {
+                publish_pending(buffer, false);
+            }
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize output_stream::xsputn(const char* s, std::streamsize n)
+    {
+        // Strings are the usual way of writing line breaks, so it is a good moment
+        // to check whether the flush interval has elapsed.
+        interrupt_guard guard;
+        thread_buffer& buffer = local_buffer();
+        buffer.pending.append(s, n);
+        publish_pending(buffer, false);
+        return n;
+    }
+
+    int output_stream::sync()
+    {
+        interrupt_guard guard;
+        publish_pending(local_buffer(), false);
+        return 0;
+    }
+
+    output_stream::thread_buffer& output_stream::local_buffer()
+    {
+        // A thread usually writes into one or two streams at a time (std::cout and
+        // std::cerr), so a linear search is the fastest.
+        thread_local std::vector<std::unique_ptr<thread_buffer>> buffers;
+        for (const std::unique_ptr<thread_buffer>& buffer : buffers)
+        {
+            if (buffer->state == m_state)
+            {
+                return *buffer;
+            }
+        }
+
+        // The buffers of the streams that no longer exist are removed.
+        buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+            [](const std::unique_ptr<thread_buffer>& buffer)
+            {
+                return buffer->state->closed.load();
+            }), buffers.end());
+        buffers.push_back(std::make_unique<thread_buffer>(m_state));
+        return *buffers.back();
+    }
+
+    void output_stream::publish_pending(thread_buffer& buffer, bool force)
+    {
+        if (buffer.pending.empty())
+        {
+            return;
+        }
+
+        const output_limits& limits = m_state->limits;
+        const auto now = std::chrono::steady_clock::now();
+        const bool full = buffer.pending.size() >= limits.flush_size;
+        const bool late = now - buffer.last_publication >= limits.flush_interval;
+        if (!force && !full && !late)
+        {
+            return;
+        }
+
+        // We publish whole lines, keeping the last incomplete one for later, unless
+        // there is none or we have been asked to publish everything.
+        std::size_t end = buffer.pending.size();
+        if (!force)
+        {
+            std::size_t last_line_break = buffer.pending.find_last_of("\n\r");
+            if (last_line_break != std::string::npos)
+            {
+                end = last_line_break + 1;
+            }
+            else if (!full)
+            {
+                return;
+            }
+        }
+
+        m_state->hand_over(buffer.pending.substr(0, end));
+        buffer.pending.erase(0, end);
+        buffer.last_publication = now;
+    }
+}
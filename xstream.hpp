@@ -0,0 +1,141 @@
+#ifndef ALS_XEUS_CLING_XSTREAM_HPP
+#define ALS_XEUS_CLING_XSTREAM_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "als-xeus-cling-config.hpp"
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Limits applied to the output a cell writes into std::cout or std::cerr.
+     * They can be changed from a cell through xci->stream_limits.
+     *
+     */
+    struct ALS_XEUS_CLING_API output_limits
+    {
+        /**
+         * @brief Pending output is published once it reaches this number of bytes.
+         *
+         */
+        std::size_t flush_size = 4096;
+
+        /**
+         * @brief Pending complete lines are published once this time has elapsed since
+         * the last publication.
+         *
+         */
+        std::chrono::milliseconds flush_interval{100};
+
+        /**
+         * @brief Maximum number of bytes of a stream published during a cell. The rest
+         * is dropped.
+         *
+         */
+        std::size_t max_bytes = 8 * 1024 * 1024;
+
+        /**
+         * @brief Number of bytes kept from the end of the output. When output has been
+         * dropped, they are published at the end of the cell after a truncation notice.
+         *
+         */
+        std::size_t tail_bytes = 64 * 1024;
+    };
+
+    /**
+     * @brief Stream buffer that publishes what is written into it incrementally, as
+     * Jupyter stream messages, instead of accumulating the whole output of the cell.
+     *
+     * Output is published in chunks bounded in size and time, preferably ending at a
+     * line break. Memory usage is bounded by flush_size per writing thread plus a ring
+     * buffer of tail_bytes, whatever the amount of output.
+     *
+     * It can be written from several threads at once (e.g. std::cout used by a pool of
+     * threads started by a cell). Every thread writes into its own buffer, without
+     * locking, so lines of different threads are never mixed; a lock is only taken
+     * when a chunk is handed over for publication. What a thread other than the one
+     * calling finish has not handed over yet (an incomplete last line) is published
+     * when that thread exits.
+     *
+     * The cell is not interrupted while it writes into the stream (see
+     * interrupt_guard), so that the lock is never left taken.
+     *
+     */
+    class ALS_XEUS_CLING_API output_stream : public std::streambuf
+    {
+        public:
+
+        using publisher = std::function<void(const std::string& text)>;
+
+        /**
+         * @brief Construct a new output stream.
+         *
+         * @param publish Function called with every chunk of text to be published. It
+         * may be called from any thread writing into the stream.
+         * @param limits Limits applied to the output.
+         */
+        output_stream(publisher publish, const output_limits& limits);
+        output_stream(const output_stream&) = delete;
+        output_stream& operator=(const output_stream&) = delete;
+        virtual ~output_stream();
+
+        /**
+         * @brief Publishes everything that is pending in the calling thread and, if
+         * output has been dropped, a truncation notice followed by the last part of the
+         * output.
+         *
+         */
+        void finish();
+
+        /**
+         * @brief Total number of bytes written into the stream so far by the threads
+         * which have handed them over, and by the calling one.
+         *
+         */
+        std::size_t written();
+
+        /**
+         * @brief Returns the output written after the first since bytes, as long as it
+         * is still kept in the ring buffer. Used to build error messages.
+         *
+         */
+        std::string recent_output(std::size_t since);
+
+        /**
+         * @brief Hands text over at once, within the limits, without going through the
+         * buffer of the calling thread. Used for output which already comes in chunks,
+         * e.g. what is read from a captured file descriptor.
+         *
+         */
+        void write_through(const std::string& text);
+
+        protected:
+
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+        int sync() override;
+
+        private:
+
+        // What the threads share: the limits and what has been published.
+        struct shared_state;
+        // Text written by one thread and not handed over yet.
+        struct thread_buffer;
+
+        // Returns the buffer of the calling thread, creating it if needed.
+        thread_buffer& local_buffer();
+        // Hands the pending text of buffer over according to the limits. If force is
+        // true, it hands everything over.
+        void publish_pending(thread_buffer& buffer, bool force);
+
+        std::shared_ptr<shared_state> m_state;
+    };
+}
+
+#endif // ALS_XEUS_CLING_XSTREAM_HPP
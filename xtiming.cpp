@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <utility>
+
+#include <unistd.h>
+
+#include "xtiming.hpp"
+
+namespace
+{
+    using als::xeus_cling::cell_timing;
+
+    double seconds(cell_timing::clock::duration duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    long long microseconds(cell_timing::clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+}
+
+namespace als::xeus_cling
+{
+    std::string format_duration(double duration)
+    {
+        const char* unit = "s";
+        if (duration < 1e-6)
+        {
+            duration *= 1e9;
+            unit = "ns";
+        }
+        else if (duration < 1e-3)
+        {
+            duration *= 1e6;
+            unit = "us";
+        }
+        else if (duration < 1)
+        {
+            duration *= 1e3;
+            unit = "ms";
+        }
+
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), duration < 10 ? "%.2f %s" :
+            (duration < 100 ? "%.1f %s" : "%.0f %s"), duration, unit);
+        return buffer;
+    }
+
+    cell_timing::cell_timing(): m_start{clock::now()}
+    {
+    }
+
+    void cell_timing::add(const std::string& phase, clock::time_point start,
+        clock::time_point end)
+    {
+        m_phases.push_back({phase, start, end});
+    }
+
+    nl::json cell_timing::to_json() const
+    {
+        nl::json res = nl::json::object();
+        for (const phase& p : m_phases)
+        {
+            res[p.name] = seconds(p.end - p.start);
+        }
+        res["total"] = seconds(clock::now() - m_start);
+        return res;
+    }
+
+    std::string cell_timing::report() const
+    {
+        std::string res;
+        for (const phase& p : m_phases)
+        {
+            res += p.name + ": " + format_duration(seconds(p.end - p.start)) + ", ";
+        }
+        res += "total: " + format_duration(seconds(clock::now() - m_start)) + "\n";
+        return res;
+    }
+
+    trace_writer::trace_writer(const std::string& path):
+        m_file{path, std::ios::trunc},
+        m_origin{cell_timing::clock::now()}
+    {
+        if (m_file)
+        {
+            m_file << "[\n";
+            m_file.flush();
+        }
+    }
+
+    bool trace_writer::is_open() const
+    {
+        return m_file.is_open();
+    }
+
+    void trace_writer::write(const cell_timing& timing, int execution_counter)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file)
+        {
+            return;
+        }
+
+        // One complete event ("ph": "X") for the whole cell, and one for each phase.
+        auto write_event = [&](const std::string& name, cell_timing::clock::time_point start,
+            cell_timing::clock::time_point end)
+        {
+            nl::json event;
+            event["name"] = name;
+            event["cat"] = "cell";
+            event["ph"] = "X";
+            event["ts"] = microseconds(start - m_origin);
+            event["dur"] = microseconds(end - start);
+            event["pid"] = getpid();
+            event["tid"] = 1;
+            event["args"] = {{"execution_count", execution_counter}};
+            m_file << event.dump() << ",\n";
+        };
+
+        write_event("cell " + std::to_string(execution_counter), timing.m_start,
+            cell_timing::clock::now());
+        for (const cell_timing::phase& p : timing.m_phases)
+        {
+            write_event(p.name, p.start, p.end);
+        }
+        m_file.flush();
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef ALS_XEUS_CLING_XTIMING_HPP
+#define ALS_XEUS_CLING_XTIMING_HPP
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace als::xeus_cling
+{
+    namespace nl = nlohmann;
+
+    /**
+     * @brief Formats a duration given in seconds with three significant digits and a
+     * suitable unit, e.g. "12.3 ms".
+     *
+     */
+    std::string format_duration(double duration);
+
+    /**
+     * @brief Durations of the phases of the execution of a cell (waiting for the
+     * interpreter, compiling, executing, publishing the output, displaying the result).
+     *
+     */
+    class cell_timing
+    {
+        public:
+
+        using clock = std::chrono::steady_clock;
+
+        /**
+         * @brief Construct a new cell timing. The cell starts now.
+         *
+         */
+        cell_timing();
+
+        /**
+         * @brief Records a phase. Phases are reported in the order they are added.
+         *
+         */
+        void add(const std::string& phase, clock::time_point start, clock::time_point end);
+
+        /**
+         * @brief The durations in seconds, e.g. {"compile": 0.12, "execute": 2.5,
+         * "total": 2.7}. The total is the time elapsed since the cell started.
+         *
+         */
+        nl::json to_json() const;
+
+        /**
+         * @brief A line of text with the durations, as shown by %%time.
+         *
+         */
+        std::string report() const;
+
+        private:
+
+        struct phase
+        {
+            std::string name;
+            clock::time_point start;
+            clock::time_point end;
+        };
+
+        friend class trace_writer;
+
+        clock::time_point m_start;
+        std::vector<phase> m_phases;
+    };
+
+    /**
+     * @brief Writes the phases of the cells into a file in the Chrome trace event
+     * format, which can be loaded into chrome://tracing or Perfetto to profile a
+     * notebook offline.
+     *
+     * Events are appended as soon as a cell finishes and the closing bracket of the
+     * array is never written, which the format allows, so the trace is usable even if
+     * the kernel dies.
+     *
+     */
+    class trace_writer
+    {
+        public:
+
+        /**
+         * @brief Opens (truncating it) the trace file.
+         *
+         */
+        explicit trace_writer(const std::string& path);
+
+        bool is_open() const;
+
+        /**
+         * @brief Appends the phases of a cell.
+         *
+         */
+        void write(const cell_timing& timing, int execution_counter);
+
+        private:
+
+        std::mutex m_mutex;
+        std::ofstream m_file;
+        // Timestamps are relative to the creation of the writer.
+        cell_timing::clock::time_point m_origin;
+    };
+}
+
+#endif // ALS_XEUS_CLING_XTIMING_HPP
@@ -0,0 +1,116 @@
+#include <utility>
+
+#include "xinterrupt.hpp"
+#include "xworker.hpp"
+
+namespace
+{
+    thread_local bool is_worker_thread = false;
+}
+
+namespace als::xeus_cling
+{
+    worker::worker():
+        m_stop{false}
+    {
+    }
+
+    worker::~worker()
+    {
+        if (m_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_condition.notify_all();
+            m_thread.join();
+        }
+    }
+
+    void worker::run(const std::function<void()>& task,
+        const std::function<void()>& while_waiting, std::chrono::milliseconds period)
+    {
+        bool done = false;
+        std::exception_ptr exception;
+        post([&]()
+            {
+                try
+                {
+                    task();
+                }
+                catch (...)
+                {
+                    exception = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(m_mutex);
+                done = true;
+                m_condition.notify_all();
+            });
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (while_waiting)
+        {
+            while (!m_condition.wait_for(lock, period, [&done]() { return done; }))
+            {
+                lock.unlock();
+                while_waiting();
+                lock.lock();
+            }
+            lock.unlock();
+            while_waiting();
+        }
+        else
+        {
+            m_condition.wait(lock, [&done]() { return done; });
+        }
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    void worker::post(std::function<void()> task)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread.joinable())
+        {
+            m_thread = std::thread(&worker::loop, this);
+        }
+        m_tasks.push_back(std::move(task));
+        m_condition.notify_all();
+    }
+
+    bool worker::on_worker_thread()
+    {
+        return is_worker_thread;
+    }
+
+    void worker::loop()
+    {
+        is_worker_thread = true;
+        accept_interrupts();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_condition.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_stop)
+            {
+                return;
+            }
+
+            std::function<void()> task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+            lock.unlock();
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+            }
+            lock.lock();
+        }
+    }
+}
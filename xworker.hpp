@@ -0,0 +1,69 @@
+#ifndef ALS_XEUS_CLING_XWORKER_HPP
+#define ALS_XEUS_CLING_XWORKER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace als::xeus_cling
+{
+    /**
+     * @brief Thread on which the cells are executed. It is the thread that receives the
+     * interruptions (SIGINT), so that the threads of the server are never interrupted.
+     *
+     * Tasks are executed one after the other, in the order they are given. The thread
+     * is only created the first time a task is given.
+     *
+     */
+    class worker
+    {
+        public:
+
+        worker();
+        worker(const worker&) = delete;
+        worker& operator=(const worker&) = delete;
+        ~worker();
+
+        /**
+         * @brief Runs task on the worker thread and waits until it has finished.
+         * Exceptions thrown by task are rethrown in the calling thread.
+         *
+         * @param task Task to be run.
+         * @param while_waiting If not empty, called by the calling thread every period
+         * while it waits, and once more when task has finished.
+         * @param period Period of while_waiting.
+         */
+        void run(const std::function<void()>& task,
+            const std::function<void()>& while_waiting = {},
+            std::chrono::milliseconds period = std::chrono::milliseconds(10));
+
+        /**
+         * @brief Queues task to be run on the worker thread, without waiting for it.
+         * Exceptions thrown by task are ignored.
+         *
+         */
+        void post(std::function<void()> task);
+
+        /**
+         * @brief Whether the calling thread is the thread of a worker.
+         *
+         */
+        static bool on_worker_thread();
+
+        private:
+
+        void loop();
+
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::deque<std::function<void()>> m_tasks;
+        bool m_stop;
+    };
+}
+
+#endif // ALS_XEUS_CLING_XWORKER_HPP